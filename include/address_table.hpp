@@ -0,0 +1,72 @@
+#ifndef MINIDBG_ADDRESS_TABLE_HPP
+#define MINIDBG_ADDRESS_TABLE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+namespace minidbg {
+    //flat table of [low, high) address ranges sorted by low address, answered by binary search.
+    //range bounds live in their own array so the search doesn't drag the payloads through the cache.
+    template <class T>
+    class address_table {
+    public:
+        void add(std::uint64_t low, std::uint64_t high, T value) {
+            if (low >= high) return;
+            m_ranges.push_back(range{low, high});
+            m_values.push_back(std::move(value));
+        }
+
+        void sort() {
+            std::vector<std::size_t> order(m_ranges.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(),
+                             [this](auto a, auto b) { return m_ranges[a].low < m_ranges[b].low; });
+
+            std::vector<range> ranges;
+            std::vector<T> values;
+            ranges.reserve(order.size());
+            values.reserve(order.size());
+            for (auto i : order) {
+                ranges.push_back(m_ranges[i]);
+                values.push_back(std::move(m_values[i]));
+            }
+            m_ranges = std::move(ranges);
+            m_values = std::move(values);
+        }
+
+        //hint is the index of the last range found; callers keep one per lookup site so
+        //that repeated queries inside the same range skip the search entirely
+        auto find(std::uint64_t addr, std::size_t& hint) const -> const T* {
+            if (hint < m_ranges.size() && m_ranges[hint].contains(addr)) {
+                return &m_values[hint];
+            }
+
+            auto it = std::upper_bound(m_ranges.begin(), m_ranges.end(), addr,
+                                       [](std::uint64_t a, const range& r) { return a < r.low; });
+            if (it == m_ranges.begin()) return nullptr;
+            --it;
+            if (!it->contains(addr)) return nullptr;
+
+            hint = it - m_ranges.begin();
+            return &m_values[hint];
+        }
+
+        auto size() const -> std::size_t { return m_ranges.size(); }
+        bool empty() const { return m_ranges.empty(); }
+
+    private:
+        struct range {
+            std::uint64_t low;
+            std::uint64_t high;
+
+            bool contains(std::uint64_t addr) const { return addr >= low && addr < high; }
+        };
+
+        std::vector<range> m_ranges;
+        std::vector<T> m_values;
+    };
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef MINIDBG_BLOCK_MAP_HPP
+#define MINIDBG_BLOCK_MAP_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "elf/elf++.hh"
+
+#include "displaced_step.hpp"
+#include "program_image.hpp"
+
+namespace minidbg {
+    //the lines a block step ran through, worked out from the code between where the thread was
+    //resumed and where it stopped. the code is decoded from the binary on disk, so breakpoints
+    //patched into the debuggee don't get in the way, and each block is only decoded once.
+    //addresses are the ones in the ELF, without any load bias
+    class block_map {
+    public:
+        explicit block_map(const program_image& image) : m_image{image} {
+            for (const auto& seg : image.get_elf().segments()) {
+                const auto& hdr = seg.get_hdr();
+                if (hdr.type == elf::pt::load && (hdr.flags & executable_flag)) {
+                    m_text.push_back(text_segment{hdr.vaddr, seg.file_size(), static_cast<const std::uint8_t*>(seg.data())});
+                }
+            }
+        }
+
+        //rows in the order they ran, with repeats folded. with taken_branch the thread got to stop by
+        //branching there, and the run ends at the first instruction which could have taken it.
+        //otherwise it was stopped before stop ran, with no branch taken on the way
+        auto find(std::uint64_t start, std::uint64_t stop, bool taken_branch) -> const std::vector<const line_row*>& {
+            auto& by_stop = m_blocks[start];
+            auto key = taken_branch ? stop : stop | linear_bit;
+            auto cached = by_stop.find(key);
+            if (cached != by_stop.end()) return cached->second;
+            return by_stop[key] = decode(start, stop, taken_branch);
+        }
+
+    private:
+        static constexpr std::uint64_t linear_bit = std::uint64_t{1} << 63;
+        static constexpr std::uint32_t executable_flag = 1; //PF_X
+        static constexpr std::size_t max_block = 4096;      //instructions, in case the walk never finds the end
+
+        struct text_segment {
+            std::uint64_t address;
+            std::uint64_t size;
+            const std::uint8_t* data;
+        };
+
+        std::vector<const line_row*> decode(std::uint64_t start, std::uint64_t stop, bool taken_branch) {
+            std::vector<const line_row*> rows;
+            auto address = start;
+            for (std::size_t n = 0; n < max_block && (taken_branch || address < stop); ++n) {
+                auto row = m_image.find_line(address, m_line_hint);
+                if (!row) break;
+                if (rows.empty() || rows.back()->id != row->id) rows.push_back(row);
+
+                std::size_t avail = 0;
+                auto code = code_at(address, avail);
+                if (!code) break;
+                auto insn = prepare_displaced_instruction(code, avail, address, address);
+                if (insn.len == 0) break;
+
+                if (taken_branch && (insn.ends_block ||
+                                     (insn.type == displaced_instruction::kind::branch && insn.target == stop))) {
+                    break;
+                }
+                address += insn.len;
+            }
+            return rows;
+        }
+
+        auto code_at(std::uint64_t address, std::size_t& avail) const -> const std::uint8_t* {
+            for (const auto& seg : m_text) {
+                if (address >= seg.address && address < seg.address + seg.size) {
+                    avail = static_cast<std::size_t>(std::min<std::uint64_t>(seg.address + seg.size - address, 16));
+                    return seg.data + (address - seg.address);
+                }
+            }
+            return nullptr;
+        }
+
+        const program_image& m_image;
+        std::vector<text_segment> m_text;
+        std::unordered_map<std::uint64_t, std::unordered_map<std::uint64_t, std::vector<const line_row*>>> m_blocks; //by start, then stop
+        std::size_t m_line_hint = 0;
+    };
+}
+
+#endif
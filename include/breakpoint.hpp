@@ -1,41 +1,146 @@
 #ifndef MINIDBG_BREAKPOINT_HPP
 #define MINIDBG_BREAKPOINT_HPP
 
+#include <algorithm>
 #include <cstdint>
-#include <sys/ptrace.h>
+#include <vector>
+
+#include "process_memory.hpp"
+#include "debug_registers.hpp"
+#include "stats.hpp"
 
 namespace minidbg {
+    enum class breakpoint_kind {
+        software,          // INT3 patched into the text
+        hardware,          // execute breakpoint in a debug register
+    };
+
     class breakpoint {
     public:
         breakpoint() = default;
-        breakpoint(pid_t pid, std::intptr_t addr) : m_pid{pid}, m_addr{addr}, m_enabled{false}, m_saved_data{} {}
+        breakpoint(process_memory& memory, debug_registers& debug, std::intptr_t addr)
+            : m_memory{&memory}, m_debug{&debug}, m_addr{addr}, m_enabled{false}, m_saved_data{} {}
 
         void enable() {
-            auto data = ptrace(PTRACE_PEEKDATA, m_pid, m_addr, nullptr);
-            m_saved_data = static_cast<uint8_t>(data & 0xff); //save bottom byte
-            uint64_t int3 = 0xcc;
-            uint64_t data_with_int3 = ((data & ~0xff) | int3); //set bottom byte to 0xcc
-            ptrace(PTRACE_POKEDATA, m_pid, m_addr, data_with_int3);
+            count_hot(get_hot_path_stats().breakpoint_enables);
+            if (m_kind == breakpoint_kind::hardware) {
+                m_slot = m_debug->set(m_addr, hw_breakpoint_type::execute, 1);
+                if (m_slot >= 0) {
+                    m_enabled = true;
+                    return;
+                }
+                m_kind = breakpoint_kind::software; //registers got taken, fall back to INT3
+            }
+
+            m_memory->read(m_addr, &m_saved_data, 1); //save the byte we're about to patch
+            uint8_t int3 = 0xcc;
+            m_memory->write(m_addr, &int3, 1);
 
             m_enabled = true;
         }
 
         void disable() {
-            auto data = ptrace(PTRACE_PEEKDATA, m_pid, m_addr, nullptr);
-            auto restored_data = ((data & ~0xff) | m_saved_data);
-            ptrace(PTRACE_POKEDATA, m_pid, m_addr, restored_data);
+            count_hot(get_hot_path_stats().breakpoint_disables);
+            if (m_kind == breakpoint_kind::hardware) {
+                m_debug->clear(m_slot);
+                m_slot = -1;
+            } else {
+                m_memory->write(m_addr, &m_saved_data, 1);
+            }
 
             m_enabled = false;
         }
 
         bool is_enabled() const { return m_enabled; }
 
+        auto get_kind() const -> breakpoint_kind { return m_kind; }
+
+        //moves the breakpoint into a debug register if one is free. hardware hits stop before
+        //the instruction runs, so resuming needs no unpatch/step/repatch round trip
+        bool make_hardware() {
+            if (m_kind == breakpoint_kind::hardware || !m_debug->has_free_slot()) return false;
+
+            auto was_enabled = m_enabled;
+            if (was_enabled) disable();
+            m_kind = breakpoint_kind::hardware;
+            if (was_enabled) enable();
+            return m_kind == breakpoint_kind::hardware;
+        }
+
+        auto record_hit() -> unsigned { return ++m_hits; }
+
+        //patch a whole group at once: sites on the same page share one read and one write
+        static void enable_all(process_memory& memory, std::vector<breakpoint*> bps) {
+            for_each_hardware(bps, [](breakpoint& bp) { bp.enable(); });
+            for_each_page(memory, bps, [](breakpoint& bp, uint8_t& byte) {
+                bp.m_saved_data = byte;
+                byte = 0xcc;
+                bp.m_enabled = true;
+            });
+        }
+
+        static void disable_all(process_memory& memory, std::vector<breakpoint*> bps) {
+            for_each_hardware(bps, [](breakpoint& bp) { bp.disable(); });
+            for_each_page(memory, bps, [](breakpoint& bp, uint8_t& byte) {
+                byte = bp.m_saved_data;
+                bp.m_enabled = false;
+            });
+        }
+
         auto get_address() const -> std::intptr_t { return m_addr; }
+        auto get_saved_data() const -> uint8_t { return m_saved_data; }
     private:
-        pid_t m_pid;
+        static constexpr std::intptr_t page_size = 4096;
+
+        //debug registers can't be batched: handle those one by one and drop them from bps
+        template <class F>
+        static void for_each_hardware(std::vector<breakpoint*>& bps, F f) {
+            auto hardware = std::partition(bps.begin(), bps.end(),
+                                           [](auto bp) { return bp->m_kind == breakpoint_kind::software; });
+            std::for_each(hardware, bps.end(), [&f](auto bp) { f(*bp); });
+            bps.erase(hardware, bps.end());
+        }
+
+        template <class F>
+        static void for_each_page(process_memory& memory, std::vector<breakpoint*>& bps, F patch) {
+            std::sort(bps.begin(), bps.end(), [](auto a, auto b) { return a->m_addr < b->m_addr; });
+
+            std::vector<uint8_t> buffer;
+            for (auto first = bps.begin(); first != bps.end();) {
+                auto page = (*first)->m_addr / page_size;
+                auto last = std::find_if(first, bps.end(), [page](auto bp) { return bp->m_addr / page_size != page; });
+
+                //read the current bytes so that other breakpoints in the span are written back as they are
+                auto low = (*first)->m_addr;
+                auto high = (*(last - 1))->m_addr + 1;
+                buffer.resize(high - low);
+                if (memory.read(low, buffer.data(), buffer.size()) == buffer.size()) {
+                    for (auto it = first; it != last; ++it) {
+                        patch(**it, buffer[(*it)->m_addr - low]);
+                    }
+                    memory.write(low, buffer.data(), buffer.size());
+                } else {
+                    //writing back a short read would put stale bytes over the code between sites
+                    for (auto it = first; it != last; ++it) {
+                        uint8_t byte = 0;
+                        memory.read((*it)->m_addr, &byte, 1);
+                        patch(**it, byte);
+                        memory.write((*it)->m_addr, &byte, 1);
+                    }
+                }
+
+                first = last;
+            }
+        }
+
+        process_memory* m_memory;
+        debug_registers* m_debug;
         std::intptr_t m_addr;
         bool m_enabled;
         uint8_t m_saved_data; //data which used to be at the breakpoint address
+        breakpoint_kind m_kind = breakpoint_kind::software;
+        int m_slot = -1;
+        unsigned m_hits = 0;
     };
 }
 
@@ -0,0 +1,290 @@
+#ifndef MINIDBG_BREAKPOINT_CONDITION_HPP
+#define MINIDBG_BREAKPOINT_CONDITION_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "variable_locations.hpp"
+
+namespace minidbg {
+    //a value a condition reads: a local, located afresh at each hit, or a global at a fixed address
+    struct condition_operand {
+        const local_variable* local = nullptr;
+        std::uint64_t address = 0;
+        std::size_t size = sizeof(std::uint64_t);
+        bool is_signed = true;
+    };
+
+    enum class condition_op : std::uint8_t {
+        push,          // value is the constant
+        load,          // value indexes the operands
+        negate, logical_not, bit_not,
+        mul, div, mod, add, sub, shl, shr,
+        lt, le, gt, ge, eq, ne,
+        bit_and, bit_xor, bit_or, logical_and, logical_or,
+    };
+
+    struct condition_insn {
+        condition_op op;
+        std::int64_t value;
+    };
+
+    //an integer expression over variables, in C syntax, compiled to stack code when the breakpoint
+    //is set. all the operands are fetched before it runs, so && and || don't short circuit: nothing
+    //in it has side effects
+    struct breakpoint_condition {
+        static constexpr std::size_t max_operands = 16;
+        static constexpr std::size_t max_depth = 32;
+
+        std::string text;
+        const function_variables* frame = nullptr; //the breakpoint's function, where locals are located
+        std::vector<condition_operand> operands;
+        std::vector<condition_insn> code;
+    };
+
+    //when a user breakpoint really stops: its condition holds and its ignore count has run out
+    struct breakpoint_filter {
+        unsigned ignore_count = 0;
+        bool has_condition = false;
+        breakpoint_condition condition;
+    };
+
+    //the bytes read for an operand, widened as its type would be
+    inline std::int64_t extend_operand(std::uint64_t raw, const condition_operand& operand) {
+        if (operand.size >= sizeof(raw)) return static_cast<std::int64_t>(raw);
+        auto shift = 64 - 8 * operand.size;
+        raw <<= shift;
+        return operand.is_signed ? static_cast<std::int64_t>(raw) >> shift : static_cast<std::int64_t>(raw >> shift);
+    }
+
+    //values holds the operands in order. arithmetic wraps, and dividing by zero gives zero
+    inline bool evaluate_condition(const breakpoint_condition& cond, const std::int64_t* values) {
+        using op = condition_op;
+        std::int64_t stack[breakpoint_condition::max_depth];
+        std::size_t top = 0;
+
+        for (const auto& insn : cond.code) {
+            if (insn.op == op::push) {
+                stack[top++] = insn.value;
+                continue;
+            }
+            if (insn.op == op::load) {
+                stack[top++] = values[insn.value];
+                continue;
+            }
+
+            auto& a = stack[top - 1];
+            switch (insn.op) {
+                case op::negate: a = static_cast<std::int64_t>(0 - static_cast<std::uint64_t>(a)); continue;
+                case op::logical_not: a = !a; continue;
+                case op::bit_not: a = ~a; continue;
+                default: break;
+            }
+
+            auto b = stack[--top];
+            auto& l = stack[top - 1];
+            auto ul = static_cast<std::uint64_t>(l), ub = static_cast<std::uint64_t>(b);
+            switch (insn.op) {
+                case op::mul: l = static_cast<std::int64_t>(ul * ub); break;
+                case op::div: l = (b == 0 || (b == -1 && l == std::numeric_limits<std::int64_t>::min())) ? 0 : l / b; break;
+                case op::mod: l = (b == 0 || b == -1) ? 0 : l % b; break;
+                case op::add: l = static_cast<std::int64_t>(ul + ub); break;
+                case op::sub: l = static_cast<std::int64_t>(ul - ub); break;
+                case op::shl: l = static_cast<std::int64_t>(ul << (ub & 63)); break;
+                case op::shr: l >>= (ub & 63); break;
+                case op::lt: l = l < b; break;
+                case op::le: l = l <= b; break;
+                case op::gt: l = l > b; break;
+                case op::ge: l = l >= b; break;
+                case op::eq: l = l == b; break;
+                case op::ne: l = l != b; break;
+                case op::bit_and: l &= b; break;
+                case op::bit_xor: l ^= b; break;
+                case op::bit_or: l |= b; break;
+                case op::logical_and: l = l && b; break;
+                case op::logical_or: l = l || b; break;
+                default: break;
+            }
+        }
+        return top > 0 && stack[top - 1] != 0;
+    }
+
+    //precedence climbing over C's binary operators. resolve finds what a variable name refers to
+    class condition_compiler {
+    public:
+        using resolver = std::function<bool(const std::string&, condition_operand&)>;
+
+        condition_compiler(const std::string& text, resolver resolve) : m_text{text}, m_resolve{std::move(resolve)} {}
+
+        //false, with error saying why, if the text doesn't parse or names something unknown
+        bool compile(breakpoint_condition& cond, std::string& error) {
+            m_cond = &cond;
+            cond.text = m_text;
+            cond.operands.clear();
+            cond.code.clear();
+            m_names.clear();
+            m_pos = m_depth = 0;
+
+            if (!parse_expression(1)) {
+                error = m_error;
+                return false;
+            }
+            skip_space();
+            if (m_pos != m_text.size()) {
+                error = "unexpected '" + m_text.substr(m_pos) + "'";
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        struct binary_operator {
+            const char* token;
+            condition_op op;
+            int precedence;
+        };
+
+        //longer tokens before their prefixes
+        static const binary_operator* match_binary(const char* p) {
+            static const binary_operator operators[] = {
+                {"||", condition_op::logical_or, 1}, {"&&", condition_op::logical_and, 2},
+                {"==", condition_op::eq, 6}, {"!=", condition_op::ne, 6},
+                {"<=", condition_op::le, 7}, {">=", condition_op::ge, 7},
+                {"<<", condition_op::shl, 8}, {">>", condition_op::shr, 8},
+                {"|", condition_op::bit_or, 3}, {"^", condition_op::bit_xor, 4}, {"&", condition_op::bit_and, 5},
+                {"<", condition_op::lt, 7}, {">", condition_op::gt, 7},
+                {"+", condition_op::add, 9}, {"-", condition_op::sub, 9},
+                {"*", condition_op::mul, 10}, {"/", condition_op::div, 10}, {"%", condition_op::mod, 10},
+            };
+            for (const auto& candidate : operators) {
+                if (std::strncmp(p, candidate.token, std::strlen(candidate.token)) == 0) return &candidate;
+            }
+            return nullptr;
+        }
+
+        bool parse_expression(int min_precedence) {
+            if (!parse_unary()) return false;
+            while (true) {
+                skip_space();
+                auto binary = match_binary(m_text.c_str() + m_pos);
+                if (!binary || binary->precedence < min_precedence) return true;
+                m_pos += std::strlen(binary->token);
+                if (!parse_expression(binary->precedence + 1)) return false;
+                if (!emit(binary->op, 0)) return false;
+            }
+        }
+
+        bool parse_unary() {
+            skip_space();
+            auto c = peek();
+            if (c == '!' && peek(1) != '=') {
+                ++m_pos;
+                return parse_unary() && emit(condition_op::logical_not, 0);
+            }
+            if (c == '-') {
+                ++m_pos;
+                return parse_unary() && emit(condition_op::negate, 0);
+            }
+            if (c == '~') {
+                ++m_pos;
+                return parse_unary() && emit(condition_op::bit_not, 0);
+            }
+            if (c == '+') {
+                ++m_pos;
+                return parse_unary();
+            }
+            return parse_primary();
+        }
+
+        bool parse_primary() {
+            skip_space();
+            auto c = peek();
+            if (c == '(') {
+                ++m_pos;
+                if (!parse_expression(1)) return false;
+                skip_space();
+                if (peek() != ')') return fail("missing ')'");
+                ++m_pos;
+                return true;
+            }
+
+            if (std::isdigit(static_cast<unsigned char>(c))) {
+                auto begin = m_text.c_str() + m_pos;
+                char* end;
+                auto value = std::strtoull(begin, &end, 0);
+                m_pos += end - begin;
+                return emit(condition_op::push, static_cast<std::int64_t>(value));
+            }
+
+            if (c == '\'' && peek(1) && peek(2) == '\'') {
+                auto value = static_cast<unsigned char>(peek(1));
+                m_pos += 3;
+                return emit(condition_op::push, value);
+            }
+
+            if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+                auto start = m_pos;
+                while (std::isalnum(static_cast<unsigned char>(peek())) || peek() == '_') ++m_pos;
+                auto name = m_text.substr(start, m_pos - start);
+                if (name == "true") return emit(condition_op::push, 1);
+                if (name == "false") return emit(condition_op::push, 0);
+
+                //a variable named twice is read once
+                auto known = std::find(m_names.begin(), m_names.end(), name);
+                if (known != m_names.end()) return emit(condition_op::load, known - m_names.begin());
+
+                if (m_names.size() == breakpoint_condition::max_operands) return fail("too many variables");
+                condition_operand operand{};
+                if (!m_resolve(name, operand)) return fail("no variable " + name + " here");
+                m_names.push_back(name);
+                m_cond->operands.push_back(operand);
+                return emit(condition_op::load, m_names.size() - 1);
+            }
+
+            if (c == 0) return fail("expression ends early");
+            return fail(std::string{"unexpected '"} + c + "'");
+        }
+
+        //keeps track of how deep the stack gets, so evaluation never needs more than max_depth
+        bool emit(condition_op op, std::int64_t value) {
+            if (op == condition_op::push || op == condition_op::load) {
+                if (++m_depth > breakpoint_condition::max_depth) return fail("expression too deep");
+            } else if (op > condition_op::bit_not) {
+                --m_depth;
+            }
+            m_cond->code.push_back(condition_insn{op, value});
+            return true;
+        }
+
+        bool fail(const std::string& message) {
+            m_error = message;
+            return false;
+        }
+
+        char peek(std::size_t ahead = 0) const {
+            return m_pos + ahead < m_text.size() ? m_text[m_pos + ahead] : 0;
+        }
+
+        void skip_space() {
+            while (std::isspace(static_cast<unsigned char>(peek()))) ++m_pos;
+        }
+
+        std::string m_text;
+        resolver m_resolve;
+        breakpoint_condition* m_cond = nullptr;
+        std::vector<std::string> m_names;
+        std::size_t m_pos = 0;
+        std::size_t m_depth = 0;
+        std::string m_error;
+    };
+}
+
+#endif
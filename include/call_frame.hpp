@@ -0,0 +1,442 @@
+#ifndef MINIDBG_CALL_FRAME_HPP
+#define MINIDBG_CALL_FRAME_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "elf/elf++.hh"
+
+#include "address_table.hpp"
+#include "variable_locations.hpp"
+
+namespace minidbg {
+    //DWARF registers 0-15 are the general purpose ones, 16 is the return address column
+    static constexpr std::size_t n_cfi_registers = 17;
+    static constexpr unsigned cfi_return_address = 16;
+    static constexpr unsigned cfi_stack_pointer = 7;
+
+    //how to get a register's value in the caller, given the CFA
+    struct register_rule {
+        enum class kind {
+            same_value,        // unchanged by this frame
+            undefined,         // can't be recovered
+            offset,            // saved at CFA + offset
+            val_offset,        // is CFA + offset
+            in_register,       // held in register reg
+        };
+
+        kind type = kind::same_value;
+        unsigned reg = 0;
+        std::int64_t offset = 0;
+    };
+
+    //one row of the CFI table: where the CFA is and how each register was saved
+    struct frame_row {
+        bool cfa_known = false;   //false for DW_CFA_def_cfa_expression, which isn't handled
+        unsigned cfa_reg = cfi_stack_pointer;
+        std::int64_t cfa_offset = 0;
+        std::array<register_rule, n_cfi_registers> registers{};
+    };
+
+    struct common_information {
+        std::uint64_t code_align;
+        std::int64_t data_align;
+        unsigned return_register;
+        std::uint8_t pointer_encoding; //of the FDE's addresses
+        bool has_augmentation_data;    //FDEs carry a length prefixed block after their addresses
+        const std::uint8_t* instructions;
+        std::size_t len;
+    };
+
+    struct frame_description {
+        const common_information* cie;
+        std::uint64_t low;
+        const std::uint8_t* instructions;
+        std::size_t len;
+        std::uint64_t section_address; //where the section is loaded, for pc relative DW_CFA_set_loc
+        const std::uint8_t* section_data;
+    };
+
+    //a frame of the call stack, with the registers as they were when it was current
+    struct stack_frame {
+        std::uint64_t pc;
+        std::array<std::uint64_t, n_cfi_registers> regs;
+        std::uint32_t known;      //bit per register in regs
+        std::uint64_t cfa;        //valid once the frame has been unwound past
+        bool has_cfa;
+    };
+
+    //frames unwound so far, kept until the thread next runs
+    struct call_stack {
+        std::vector<stack_frame> frames;
+        bool complete = false;    //no frames beyond the last one can be found
+    };
+
+    //the FDEs of .eh_frame and .debug_frame, indexed by the pcs they cover. parsed once with
+    //the program image; rows are worked out on demand by running the instructions up to the pc
+    class call_frame_table {
+    public:
+        void load(const elf::elf& elf) {
+            for (const auto& section : elf.sections()) {
+                if (section.get_name() == ".eh_frame") parse(section, true);
+                else if (section.get_name() == ".debug_frame") parse(section, false);
+            }
+            m_fdes.sort();
+        }
+
+        auto find(std::uint64_t pc, std::size_t& hint) const -> const frame_description* {
+            return m_fdes.find(pc, hint);
+        }
+
+        //runs the CIE's and the FDE's instructions up to pc. false if they use something unsupported
+        static bool find_row(const frame_description& fde, std::uint64_t pc, frame_row& row) {
+            frame_row initial{};
+            if (!execute(*fde.cie, fde.cie->instructions, fde.cie->len, 0, ~std::uint64_t{0}, initial, initial, nullptr)) {
+                return false;
+            }
+            row = initial;
+            return execute(*fde.cie, fde.instructions, fde.len, fde.low, pc, row, initial, &fde);
+        }
+
+    private:
+        static std::uint64_t read_pointer(const std::uint8_t*& p, const std::uint8_t* end, std::uint8_t encoding,
+                                          std::uint64_t field_address, bool& ok) {
+            auto fixed = [&](std::size_t n, bool is_signed) -> std::uint64_t {
+                if (p + n > end) {
+                    ok = false;
+                    return 0;
+                }
+                std::uint64_t value = 0;
+                std::memcpy(&value, p, n);
+                if (is_signed && n < 8 && (value >> (n * 8 - 1)) & 1) value |= ~std::uint64_t{0} << (n * 8);
+                p += n;
+                return value;
+            };
+
+            std::uint64_t value;
+            switch (encoding & 0x0f) {
+                case 0x00: value = fixed(8, false); break;
+                case 0x01: value = read_uleb128(p, end); break;
+                case 0x02: value = fixed(2, false); break;
+                case 0x03: value = fixed(4, false); break;
+                case 0x04: value = fixed(8, false); break;
+                case 0x09: value = read_sleb128(p, end); break;
+                case 0x0a: value = fixed(2, true); break;
+                case 0x0b: value = fixed(4, true); break;
+                case 0x0c: value = fixed(8, true); break;
+                default: ok = false; return 0;
+            }
+
+            switch (encoding & 0x70) {
+                case 0x00: break;
+                case 0x10: value += field_address; break;
+                default: ok = false; break; //datarel, textrel and funcrel don't turn up in executables
+            }
+            if (encoding & 0x80) ok = false; //indirect
+            return value;
+        }
+
+        void parse(const elf::section& section, bool eh_frame) {
+            auto data = static_cast<const std::uint8_t*>(section.data());
+            auto size = section.size();
+            auto address = section.get_hdr().addr;
+            std::unordered_map<std::size_t, const common_information*> cies; //by offset in the section
+
+            std::size_t offset = 0;
+            while (offset + 4 <= size) {
+                std::uint64_t length = 0;
+                std::memcpy(&length, data + offset, 4);
+                auto header = offset + 4;
+                if (length == 0xffffffff) {
+                    if (header + 8 > size) return;
+                    std::memcpy(&length, data + header, 8);
+                    header += 8;
+                }
+                if (length == 0) {
+                    if (eh_frame) return; //terminator
+                    offset = header;
+                    continue;
+                }
+                auto end = header + length;
+                if (end > size || header + 4 > end) return;
+
+                std::uint32_t id;
+                std::memcpy(&id, data + header, 4);
+                auto is_cie = eh_frame ? id == 0 : id == 0xffffffff;
+                auto p = data + header + 4, entry_end = data + end;
+
+                if (is_cie) {
+                    if (auto cie = parse_cie(p, entry_end, eh_frame)) cies[offset] = cie;
+                } else {
+                    auto cie_offset = eh_frame ? header - id : static_cast<std::size_t>(id);
+                    auto cie = cies.find(cie_offset);
+                    if (cie != cies.end()) parse_fde(p, entry_end, *cie->second, data, address);
+                }
+                offset = end;
+            }
+        }
+
+        auto parse_cie(const std::uint8_t* p, const std::uint8_t* end, bool eh_frame) -> const common_information* {
+            if (p >= end) return nullptr;
+            auto version = *p++;
+            auto augmentation = reinterpret_cast<const char*>(p);
+            auto aug_len = strnlen(augmentation, end - p);
+            if (p + aug_len >= end) return nullptr;
+            std::string aug{augmentation, aug_len};
+            p += aug_len + 1;
+            if (!eh_frame && version >= 4) p += 2; //address and segment selector sizes
+
+            common_information cie{};
+            cie.code_align = read_uleb128(p, end);
+            cie.data_align = read_sleb128(p, end);
+            cie.return_register = version == 1 ? *p++ : read_uleb128(p, end);
+            cie.pointer_encoding = eh_frame ? 0x00 : 0x04;
+
+            if (!aug.empty() && aug[0] == 'z') {
+                cie.has_augmentation_data = true;
+                auto data_len = read_uleb128(p, end);
+                auto data_end = p + data_len;
+                auto ok = true;
+                for (std::size_t i = 1; i < aug.size() && p < data_end; ++i) {
+                    switch (aug[i]) {
+                        case 'R': cie.pointer_encoding = *p++; break;
+                        case 'L': ++p; break;
+                        case 'P': {
+                            auto encoding = *p++;
+                            read_pointer(p, data_end, encoding & 0x0f, 0, ok); //only skipped, so no pcrel
+                            break;
+                        }
+                        case 'S': case 'B': break;
+                        default: return nullptr;
+                    }
+                }
+                p = data_end;
+            } else if (!aug.empty()) {
+                return nullptr; //gcc's old "eh" and the like
+            }
+            if (p > end) return nullptr;
+
+            cie.instructions = p;
+            cie.len = end - p;
+            m_cies.push_back(cie);
+            return &m_cies.back();
+        }
+
+        void parse_fde(const std::uint8_t* p, const std::uint8_t* end, const common_information& cie,
+                       const std::uint8_t* section_data, std::uint64_t section_address) {
+            auto ok = true;
+            auto field = section_address + (p - section_data);
+            auto low = read_pointer(p, end, cie.pointer_encoding, field, ok);
+            auto range = read_pointer(p, end, cie.pointer_encoding & 0x0f, 0, ok);
+            if (!ok) return;
+
+            if (cie.has_augmentation_data) {
+                auto data_len = read_uleb128(p, end);
+                p += data_len;
+            }
+            if (p > end) return;
+
+            m_fdes.add(low, low + range, frame_description{&cie, low, p, static_cast<std::size_t>(end - p),
+                                                           section_address, section_data});
+        }
+
+        //fde is only needed for DW_CFA_set_loc, which CIEs can't use
+        static bool execute(const common_information& cie, const std::uint8_t* p, std::size_t len, std::uint64_t loc,
+                            std::uint64_t pc, frame_row& row, const frame_row& initial, const frame_description* fde) {
+            auto end = p + len;
+            std::vector<frame_row> saved;
+
+            auto set_rule = [&](std::uint64_t reg, register_rule rule) {
+                if (reg < n_cfi_registers) row.registers[reg] = rule;
+            };
+            auto offset_rule = [&](std::int64_t offset) {
+                return register_rule{register_rule::kind::offset, 0, offset};
+            };
+
+            while (p < end) {
+                auto op = *p++;
+                auto low_bits = op & 0x3f;
+                switch (op & 0xc0) {
+                    case 0x40: //advance_loc
+                        loc += low_bits * cie.code_align;
+                        if (loc > pc) return true;
+                        continue;
+                    case 0x80: //offset
+                        set_rule(low_bits, offset_rule(read_uleb128(p, end) * cie.data_align));
+                        continue;
+                    case 0xc0: //restore
+                        if (static_cast<std::size_t>(low_bits) < n_cfi_registers) row.registers[low_bits] = initial.registers[low_bits];
+                        continue;
+                    default:
+                        break;
+                }
+
+                switch (op) {
+                    case 0x00: break; //nop
+                    case 0x01: { //set_loc
+                        if (!fde) return false;
+                        auto ok = true;
+                        auto field = fde->section_address + (p - fde->section_data);
+                        loc = read_pointer(p, end, cie.pointer_encoding, field, ok);
+                        if (!ok) return false;
+                        if (loc > pc) return true;
+                        break;
+                    }
+                    case 0x02: case 0x03: case 0x04: { //advance_loc1, 2, 4
+                        std::size_t n = op == 0x02 ? 1 : op == 0x03 ? 2 : 4;
+                        if (p + n > end) return false;
+                        std::uint32_t delta = 0;
+                        std::memcpy(&delta, p, n);
+                        p += n;
+                        loc += delta * cie.code_align;
+                        if (loc > pc) return true;
+                        break;
+                    }
+                    case 0x05: { //offset_extended
+                        auto reg = read_uleb128(p, end);
+                        set_rule(reg, offset_rule(read_uleb128(p, end) * cie.data_align));
+                        break;
+                    }
+                    case 0x06: { //restore_extended
+                        auto reg = read_uleb128(p, end);
+                        if (reg < n_cfi_registers) row.registers[reg] = initial.registers[reg];
+                        break;
+                    }
+                    case 0x07: //undefined
+                        set_rule(read_uleb128(p, end), register_rule{register_rule::kind::undefined});
+                        break;
+                    case 0x08: //same_value
+                        set_rule(read_uleb128(p, end), register_rule{});
+                        break;
+                    case 0x09: { //register
+                        auto reg = read_uleb128(p, end);
+                        auto from = read_uleb128(p, end);
+                        set_rule(reg, register_rule{register_rule::kind::in_register, static_cast<unsigned>(from)});
+                        break;
+                    }
+                    case 0x0a: saved.push_back(row); break; //remember_state
+                    case 0x0b: //restore_state, CFA included as gcc and libunwind expect
+                        if (saved.empty()) return false;
+                        row = saved.back();
+                        saved.pop_back();
+                        break;
+                    case 0x0c: //def_cfa
+                        row.cfa_reg = read_uleb128(p, end);
+                        row.cfa_offset = read_uleb128(p, end);
+                        row.cfa_known = true;
+                        break;
+                    case 0x0d: //def_cfa_register
+                        row.cfa_reg = read_uleb128(p, end);
+                        break;
+                    case 0x0e: //def_cfa_offset
+                        row.cfa_offset = read_uleb128(p, end);
+                        break;
+                    case 0x0f: { //def_cfa_expression
+                        auto n = read_uleb128(p, end);
+                        p += n;
+                        row.cfa_known = false;
+                        break;
+                    }
+                    case 0x10: case 0x16: { //expression, val_expression
+                        auto reg = read_uleb128(p, end);
+                        auto n = read_uleb128(p, end);
+                        p += n;
+                        set_rule(reg, register_rule{register_rule::kind::undefined});
+                        break;
+                    }
+                    case 0x11: { //offset_extended_sf
+                        auto reg = read_uleb128(p, end);
+                        set_rule(reg, offset_rule(read_sleb128(p, end) * cie.data_align));
+                        break;
+                    }
+                    case 0x12: //def_cfa_sf
+                        row.cfa_reg = read_uleb128(p, end);
+                        row.cfa_offset = read_sleb128(p, end) * cie.data_align;
+                        row.cfa_known = true;
+                        break;
+                    case 0x13: //def_cfa_offset_sf
+                        row.cfa_offset = read_sleb128(p, end) * cie.data_align;
+                        break;
+                    case 0x14: { //val_offset
+                        auto reg = read_uleb128(p, end);
+                        set_rule(reg, register_rule{register_rule::kind::val_offset, 0,
+                                                    static_cast<std::int64_t>(read_uleb128(p, end)) * cie.data_align});
+                        break;
+                    }
+                    case 0x15: { //val_offset_sf
+                        auto reg = read_uleb128(p, end);
+                        set_rule(reg, register_rule{register_rule::kind::val_offset, 0, read_sleb128(p, end) * cie.data_align});
+                        break;
+                    }
+                    case 0x2e: //GNU_args_size
+                        read_uleb128(p, end);
+                        break;
+                    case 0x2f: { //GNU_negative_offset_extended
+                        auto reg = read_uleb128(p, end);
+                        set_rule(reg, offset_rule(-static_cast<std::int64_t>(read_uleb128(p, end)) * cie.data_align));
+                        break;
+                    }
+                    default:
+                        return false;
+                }
+            }
+            return true;
+        }
+
+        std::deque<common_information> m_cies; //a deque so the FDEs' pointers stay put
+        address_table<frame_description> m_fdes;
+    };
+
+    //the caller of frame, through row. read(address, value) fetches a word of the debuggee's memory.
+    //false when the CFA or the return address can't be recovered
+    template <class Read>
+    bool unwind_frame(stack_frame& frame, const frame_row& row, unsigned return_register, Read read, stack_frame& caller) {
+        if (!row.cfa_known || row.cfa_reg >= n_cfi_registers || !(frame.known & (1u << row.cfa_reg))) return false;
+        frame.cfa = frame.regs[row.cfa_reg] + row.cfa_offset;
+        frame.has_cfa = true;
+
+        caller = stack_frame{};
+        for (unsigned reg = 0; reg < n_cfi_registers; ++reg) {
+            const auto& rule = row.registers[reg];
+            switch (rule.type) {
+                case register_rule::kind::same_value:
+                    caller.regs[reg] = frame.regs[reg];
+                    caller.known |= frame.known & (1u << reg);
+                    break;
+                case register_rule::kind::undefined:
+                    break;
+                case register_rule::kind::offset:
+                    if (read(frame.cfa + rule.offset, caller.regs[reg])) caller.known |= 1u << reg;
+                    break;
+                case register_rule::kind::val_offset:
+                    caller.regs[reg] = frame.cfa + rule.offset;
+                    caller.known |= 1u << reg;
+                    break;
+                case register_rule::kind::in_register:
+                    if (rule.reg < n_cfi_registers) {
+                        caller.regs[reg] = frame.regs[rule.reg];
+                        caller.known |= frame.known & (1u << rule.reg);
+                    }
+                    break;
+            }
+        }
+
+        //the caller's stack pointer is the CFA unless the rules say otherwise
+        if (row.registers[cfi_stack_pointer].type == register_rule::kind::same_value) {
+            caller.regs[cfi_stack_pointer] = frame.cfa;
+            caller.known |= 1u << cfi_stack_pointer;
+        }
+
+        if (return_register >= n_cfi_registers || !(caller.known & (1u << return_register))) return false;
+        caller.pc = caller.regs[return_register];
+        return caller.pc != 0;
+    }
+}
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef MINIDBG_COVERAGE_CACHE_HPP
+#define MINIDBG_COVERAGE_CACHE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "program_image.hpp"
+#include "test_manifest.hpp"
+
+namespace minidbg {
+    //64 bit FNV-1a: enough to tell tests apart without keeping them
+    inline std::uint64_t fnv1a(const void* data, std::size_t len, std::uint64_t hash = 0xcbf29ce484222325ull) {
+        auto p = static_cast<const std::uint8_t*>(data);
+        for (std::size_t i = 0; i < len; ++i) {
+            hash = (hash ^ p[i]) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    //the linker's build-id in hex, or a hash of the whole file for binaries built without one
+    inline std::string binary_identity(const program_image& image) {
+        static const char digits[] = "0123456789abcdef";
+        const auto& note = image.get_elf().get_section(".note.gnu.build-id");
+        if (note.valid() && note.size() >= 16) {
+            //namesz, descsz, type, then the name padded to 4 bytes and the id itself
+            auto data = static_cast<const std::uint8_t*>(note.data());
+            std::uint32_t name_size, desc_size;
+            std::memcpy(&name_size, data, sizeof(name_size));
+            std::memcpy(&desc_size, data + 4, sizeof(desc_size));
+            auto desc = 12 + ((name_size + 3) & ~3u);
+            if (desc + desc_size <= note.size()) {
+                std::string id;
+                for (std::uint32_t i = 0; i < desc_size; ++i) {
+                    id += digits[data[desc + i] >> 4];
+                    id += digits[data[desc + i] & 0xf];
+                }
+                return id;
+            }
+        }
+
+        std::uint64_t hash = fnv1a(nullptr, 0);
+        auto fd = open(image.get_path().c_str(), O_RDONLY);
+        if (fd >= 0) {
+            char buffer[65536];
+            ssize_t n;
+            while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+                hash = fnv1a(buffer, n, hash);
+            }
+            close(fd);
+        }
+        char id[24];
+        std::snprintf(id, sizeof(id), "file-%016llx", static_cast<unsigned long long>(hash));
+        return id;
+    }
+
+    //a result as it sits in the mapping
+    struct cached_result {
+        bool passed;
+        std::uint32_t n_lines;
+        const std::uint32_t* lines; //(line id, count) pairs for the lines which ran
+        text_view answer;
+    };
+
+    //results of tests already traced against this exact binary, in dir/<identity>.cov. the file is
+    //mapped and indexed when opened, and new results are appended to it as they come in:
+    //    header   "minidbgC", format version, line count
+    //    records  key, passed, line count, answer length, padding, then the (id, count) pairs
+    //             and the answer, padded to 8 bytes
+    //a record cut short by a crash is cut off when the file is next opened, before anything is
+    //appended after it. writers hold the file's lock, so a record still being written isn't taken for one
+    class coverage_cache {
+    public:
+        coverage_cache(const std::string& dir, const program_image& image) : m_line_count(image.line_count()) {
+            mkdir(dir.c_str(), 0777);
+            auto path = dir + "/" + binary_identity(image) + ".cov";
+            m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+            if (m_fd < 0) return;
+
+            //held while the header is checked, so two runs can't both start the file over
+            flock(m_fd, LOCK_EX);
+            struct stat st;
+            if (fstat(m_fd, &st) == 0) {
+                m_size = st.st_size;
+                if (m_size > 0) {
+                    auto data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+                    if (data != MAP_FAILED) m_data = static_cast<const char*>(data);
+                }
+                std::size_t good_size;
+                if (!load(good_size)) {
+                    start_over();
+                } else if (good_size < m_size && ftruncate(m_fd, good_size) < 0) {
+                    close(m_fd);
+                    m_fd = -1;
+                }
+            }
+            flock(m_fd, LOCK_UN);
+        }
+
+        ~coverage_cache() {
+            if (m_data) munmap(const_cast<char*>(m_data), m_size);
+            if (m_fd >= 0) close(m_fd);
+        }
+
+        coverage_cache(const coverage_cache&) = delete;
+        coverage_cache& operator=(const coverage_cache&) = delete;
+
+        bool valid() const { return m_fd >= 0; }
+
+        //what a test is cached under. salt stands for the options which change what tracing finds
+        static std::uint64_t key(const test_case& test, std::uint64_t salt) {
+            auto hash = fnv1a(&salt, sizeof(salt));
+            for (const auto& arg : test.args) {
+                hash = fnv1a(arg.data, arg.size, hash);
+                hash = fnv1a("", 1, hash);
+            }
+            std::uint8_t flags[] = {test.has_stdin, test.expected_block};
+            hash = fnv1a(flags, sizeof(flags), hash);
+            hash = fnv1a(test.stdin_payload.data, test.stdin_payload.size, hash);
+            hash = fnv1a("", 1, hash);
+            return fnv1a(test.expected.data, test.expected.size, hash);
+        }
+
+        //only the results which were in the file when it was opened. safe to call from any thread
+        bool find(std::uint64_t key, cached_result& result) const {
+            auto found = m_index.find(key);
+            if (found == m_index.end()) {
+                ++m_misses;
+                return false;
+            }
+
+            auto record = m_data + found->second;
+            std::uint32_t fields[4];
+            std::memcpy(fields, record + sizeof(std::uint64_t), sizeof(fields));
+            result.passed = fields[0] != 0;
+            result.n_lines = fields[1];
+            result.lines = reinterpret_cast<const std::uint32_t*>(record + record_header);
+            result.answer = text_view{record + record_header + fields[1] * 2 * sizeof(std::uint32_t), fields[2]};
+            ++m_hits;
+            return true;
+        }
+
+        //one write per record, which O_APPEND keeps whole even with other runs appending too
+        void add(std::uint64_t key, bool passed, const std::vector<std::uint32_t>& counts, const std::string& answer) {
+            if (m_fd < 0) return;
+
+            std::vector<std::uint32_t> lines;
+            for (std::uint32_t id = 0; id < counts.size(); ++id) {
+                if (!counts[id]) continue;
+                lines.push_back(id);
+                lines.push_back(counts[id]);
+            }
+
+            std::string record(record_header, '\0');
+            std::uint32_t fields[4] = {passed, static_cast<std::uint32_t>(lines.size() / 2),
+                                       static_cast<std::uint32_t>(answer.size()), 0};
+            std::memcpy(&record[0], &key, sizeof(key));
+            std::memcpy(&record[sizeof(key)], fields, sizeof(fields));
+            record.append(reinterpret_cast<const char*>(lines.data()), lines.size() * sizeof(std::uint32_t));
+            record += answer;
+            record.resize((record.size() + 7) & ~std::size_t{7});
+
+            std::lock_guard<std::mutex> lock{m_mutex};
+            flock(m_fd, LOCK_EX);
+            if (write(m_fd, record.data(), record.size()) != static_cast<ssize_t>(record.size())) {
+                std::cerr << "Error writing to the coverage cache\n";
+            }
+            flock(m_fd, LOCK_UN);
+        }
+
+        auto hits() const -> std::size_t { return m_hits; }
+        auto misses() const -> std::size_t { return m_misses; }
+
+    private:
+        static constexpr const char* magic = "minidbgC";
+        static constexpr std::size_t magic_size = 8;
+        static constexpr std::uint32_t version = 1;
+        static constexpr std::size_t file_header = 16;
+        static constexpr std::size_t record_header = 24;
+
+        //false if the file is empty or was written for another format or line table. good_size is
+        //where the last whole record ends
+        bool load(std::size_t& good_size) {
+            if (!m_data || m_size < file_header || std::memcmp(m_data, magic, magic_size) != 0) return false;
+            std::uint32_t header[2];
+            std::memcpy(header, m_data + magic_size, sizeof(header));
+            if (header[0] != version || header[1] != m_line_count) return false;
+
+            std::size_t offset = file_header;
+            while (offset + record_header <= m_size) {
+                std::uint64_t key;
+                std::uint32_t fields[4];
+                std::memcpy(&key, m_data + offset, sizeof(key));
+                std::memcpy(fields, m_data + offset + sizeof(key), sizeof(fields));
+
+                auto size = (record_header + std::size_t{fields[1]} * 2 * sizeof(std::uint32_t) + fields[2] + 7) & ~std::size_t{7};
+                if (offset + size > m_size) break;
+                m_index[key] = offset;
+                offset += size;
+            }
+            good_size = offset;
+            return true;
+        }
+
+        void start_over() {
+            if (m_data) munmap(const_cast<char*>(m_data), m_size);
+            m_data = nullptr;
+            m_size = 0;
+            m_index.clear();
+
+            char header[file_header];
+            std::uint32_t fields[2] = {version, static_cast<std::uint32_t>(m_line_count)};
+            std::memcpy(header, magic, magic_size);
+            std::memcpy(header + magic_size, fields, sizeof(fields));
+            if (ftruncate(m_fd, 0) < 0 || write(m_fd, header, sizeof(header)) != sizeof(header)) {
+                close(m_fd);
+                m_fd = -1;
+            }
+        }
+
+        std::size_t m_line_count;
+        int m_fd = -1;
+        const char* m_data = nullptr;
+        std::size_t m_size = 0;
+        std::unordered_map<std::uint64_t, std::size_t> m_index; //record offsets by key
+        std::mutex m_mutex;
+        mutable std::atomic<std::size_t> m_hits{0};
+        mutable std::atomic<std::size_t> m_misses{0};
+    };
+}
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef MINIDBG_COVERAGE_SINK_HPP
+#define MINIDBG_COVERAGE_SINK_HPP
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "program_image.hpp"
+#include "source_cache.hpp"
+
+namespace minidbg {
+    //how one test case went, handed to the sink once the debuggee has exited
+    struct test_report {
+        std::size_t index;
+        std::string expected;
+        std::string answer;
+        bool passed;
+    };
+
+    //where coverage goes. sinks are shared by the parallel workers, so they keep no state of their
+    //own and write everything to the stream they're given
+    class coverage_sink {
+    public:
+        virtual ~coverage_sink() = default;
+
+        //written once before any test
+        virtual void begin(std::ostream&, const program_image&) {}
+
+        //true if the stream is a human readable transcript, which the debugger's notes can go to
+        virtual bool transcript() const { return false; }
+
+        //true to be told about every line as the debuggee reaches it
+        virtual bool wants_lines() const { return false; }
+        virtual void line_reached(std::ostream&, const source_file&, unsigned) {}
+
+        //counts holds the hits of every line, by line_id
+        virtual void test_finished(std::ostream& out, const program_image& image, const test_report& report,
+                                   const std::vector<std::uint32_t>& counts) = 0;
+    };
+
+    //the original transcript: every line as it runs, then a summary and the verdict
+    class text_sink : public coverage_sink {
+    public:
+        explicit text_sink(bool echo_source) : m_echo_source{echo_source} {}
+
+        bool transcript() const override { return true; }
+        bool wants_lines() const override { return m_echo_source; }
+
+        void line_reached(std::ostream& out, const source_file& file, unsigned line) override {
+            out << "Now Execute--" << line << "Line" << "\n";
+
+            if (line == 0) {
+                out << "Error 1: 行数错误，不能为0或负数。";
+            } else if (!file.valid()) {
+                out << "Error 2: 文件不存在。";
+            } else if (line > file.line_count()) {
+                out << "Error 3: 行数超出文件长度。";
+            } else {
+                auto text = file.get_line(line);
+                out.write(text.data, text.size);
+            }
+
+            out << "\n";
+        }
+
+        void test_finished(std::ostream& out, const program_image& image, const test_report& report,
+                           const std::vector<std::uint32_t>& counts) override {
+            out << "\n";
+            out << "Conclusion:   \n";
+            for (line_id id = 0; id < counts.size(); ++id) {
+                if (!counts[id]) continue;
+                const auto& location = image.get_location(id);
+                out << "Line " << location.file << ":" << location.line << "was executed for" << " : "
+                    << counts[id] << " TIMES" << "\n";
+            }
+
+            out << "\n";
+            out << "result----- \n";
+            out << "correct answer:" << report.expected << "\n";
+            out << "test answer: " << report.answer << "\n";
+            out << (report.passed ? "success-----\n" : "fail-----\n");
+        }
+
+    private:
+        bool m_echo_source;
+    };
+
+    //one JSON object per test and line, with the lines that ran keyed by "file:line"
+    class json_sink : public coverage_sink {
+    public:
+        void test_finished(std::ostream& out, const program_image& image, const test_report& report,
+                           const std::vector<std::uint32_t>& counts) override {
+            out << "{\"test\":" << report.index
+                << ",\"passed\":" << (report.passed ? "true" : "false")
+                << ",\"expected\":" << quote(report.expected)
+                << ",\"answer\":" << quote(report.answer)
+                << ",\"lines\":{";
+            auto first = true;
+            for (line_id id = 0; id < counts.size(); ++id) {
+                if (!counts[id]) continue;
+                const auto& location = image.get_location(id);
+                out << (first ? "" : ",") << quote(location.file + ":" + std::to_string(location.line))
+                    << ":" << counts[id];
+                first = false;
+            }
+            out << "}}\n";
+        }
+
+    private:
+        static std::string quote(const std::string& s) {
+            std::string quoted{"\""};
+            for (auto c : s) {
+                if (c == '"' || c == '\\') {
+                    quoted += '\\';
+                    quoted += c;
+                } else if (static_cast<unsigned char>(c) < 0x20) {
+                    static const char hex[] = "0123456789abcdef";
+                    quoted += "\\u00";
+                    quoted += hex[(c >> 4) & 0xf];
+                    quoted += hex[c & 0xf];
+                } else {
+                    quoted += c;
+                }
+            }
+            return quoted + "\"";
+        }
+    };
+
+    //one lcov tracefile record per test and source file, listing every line with code
+    class lcov_sink : public coverage_sink {
+    public:
+        void test_finished(std::ostream& out, const program_image& image, const test_report& report,
+                           const std::vector<std::uint32_t>& counts) override {
+            out << "TN:test_" << report.index << "\n";
+
+            //ids run in file order, so each file is one contiguous block
+            for (line_id first = 0; first < counts.size();) {
+                const auto& file = image.get_location(first).file;
+                auto hit = 0u;
+                auto last = first;
+                out << "SF:" << file << "\n";
+                for (; last < counts.size() && image.get_location(last).file == file; ++last) {
+                    out << "DA:" << image.get_location(last).line << "," << counts[last] << "\n";
+                    if (counts[last]) ++hit;
+                }
+                out << "LH:" << hit << "\n" << "LF:" << last - first << "\n" << "end_of_record\n";
+                first = last;
+            }
+        }
+    };
+
+    //"MDBGCOV1", u32 n_lines, then for each line_id: u32 line, u32 length, the file name.
+    //then per test: u32 index, u8 passed, u32 n, n * (u32 line_id, u32 count). host byte order
+    class binary_sink : public coverage_sink {
+    public:
+        void begin(std::ostream& out, const program_image& image) override {
+            out.write("MDBGCOV1", 8);
+            put(out, static_cast<std::uint32_t>(image.line_count()));
+            for (line_id id = 0; id < image.line_count(); ++id) {
+                const auto& location = image.get_location(id);
+                put(out, location.line);
+                put(out, static_cast<std::uint32_t>(location.file.size()));
+                out.write(location.file.data(), location.file.size());
+            }
+        }
+
+        void test_finished(std::ostream& out, const program_image&, const test_report& report,
+                           const std::vector<std::uint32_t>& counts) override {
+            std::uint32_t n = 0;
+            for (auto count : counts) {
+                if (count) ++n;
+            }
+
+            put(out, static_cast<std::uint32_t>(report.index));
+            out.put(report.passed ? 1 : 0);
+            put(out, n);
+            for (line_id id = 0; id < counts.size(); ++id) {
+                if (!counts[id]) continue;
+                put(out, id);
+                put(out, counts[id]);
+            }
+        }
+
+    private:
+        static void put(std::ostream& out, std::uint32_t value) {
+            out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+    };
+
+    //text, json, lcov or binary; nullptr for anything else
+    inline std::unique_ptr<coverage_sink> make_coverage_sink(const std::string& format, bool echo_source) {
+        if (format == "text") return std::unique_ptr<coverage_sink>{new text_sink{echo_source}};
+        if (format == "json") return std::unique_ptr<coverage_sink>{new json_sink{}};
+        if (format == "lcov") return std::unique_ptr<coverage_sink>{new lcov_sink{}};
+        if (format == "binary") return std::unique_ptr<coverage_sink>{new binary_sink{}};
+        return nullptr;
+    }
+}
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef MINIDBG_DEBUG_REGISTERS_HPP
+#define MINIDBG_DEBUG_REGISTERS_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+
+#include "stats.hpp"
+
+namespace minidbg {
+    //values of the RW field in DR7
+    enum class hw_breakpoint_type {
+        execute = 0,
+        write = 1,
+        read_write = 3,
+    };
+
+    struct watchpoint {
+        std::string name;
+        std::uint64_t address;
+        std::size_t len;
+        std::uint64_t value; //contents when last seen, to report what changed
+    };
+
+    //the four x86 debug address registers DR0-DR3, programmed through DR7. they're per
+    //thread, so every setting is written into each thread of the debuggee
+    class debug_registers {
+    public:
+        static constexpr std::size_t n_slots = 4;
+
+        explicit debug_registers(pid_t pid) : m_tids{pid} {}
+
+        bool in_use() const { return m_dr7 != 0; }
+
+        //threads start out with clear debug registers: copy in the current settings
+        void add_thread(pid_t tid) {
+            m_tids.push_back(tid);
+            for (std::size_t i = 0; i < n_slots; ++i) {
+                if (m_slots[i].used) poke(tid, i, m_slots[i].address);
+            }
+            if (m_dr7) poke(tid, 7, m_dr7);
+        }
+
+        void remove_thread(pid_t tid) {
+            m_tids.erase(std::remove(m_tids.begin(), m_tids.end(), tid), m_tids.end());
+        }
+
+        bool has_free_slot() const {
+            for (const auto& s : m_slots) {
+                if (!s.used) return true;
+            }
+            return false;
+        }
+
+        //len must be 1, 2, 4 or 8 and address aligned to it; execute breakpoints must use 1.
+        //returns the slot used, or -1 if none is free or the kernel refused the setting
+        auto set(std::uint64_t address, hw_breakpoint_type type, std::size_t len) -> int {
+            auto len_bits = encode_length(len);
+            if (len_bits < 0 || address % len != 0) return -1;
+
+            for (std::size_t i = 0; i < n_slots; ++i) {
+                if (m_slots[i].used) continue;
+
+                auto dr7 = m_dr7 & ~control_mask(i);
+                dr7 |= (1ull << (i * 2))
+                     | (static_cast<std::uint64_t>(type) << (16 + i * 4))
+                     | (static_cast<std::uint64_t>(len_bits) << (18 + i * 4));
+
+                //the address has to be in place before DR7 enables it
+                if (!poke_all(i, address) || !poke_all(7, dr7)) return -1;
+
+                m_dr7 = dr7;
+                m_slots[i] = slot{true, address, type, len};
+                return static_cast<int>(i);
+            }
+            return -1;
+        }
+
+        void clear(int index) {
+            if (index < 0 || index >= static_cast<int>(n_slots) || !m_slots[index].used) return;
+
+            m_dr7 &= ~control_mask(index);
+            poke_all(7, m_dr7);
+            m_slots[index].used = false;
+        }
+
+        //which slot caused the last debug trap in thread tid, or -1. resets DR6, which the CPU never clears
+        auto take_hit(pid_t tid) -> int {
+            count_ptrace(PTRACE_PEEKUSER);
+            auto dr6 = ptrace(PTRACE_PEEKUSER, tid, offset(6), nullptr);
+            poke(tid, 6, 0);
+
+            for (std::size_t i = 0; i < n_slots; ++i) {
+                if (m_slots[i].used && (dr6 & (1 << i))) return static_cast<int>(i);
+            }
+            return -1;
+        }
+
+        auto get_address(int index) const -> std::uint64_t { return m_slots[index].address; }
+        auto get_type(int index) const -> hw_breakpoint_type { return m_slots[index].type; }
+        auto get_length(int index) const -> std::size_t { return m_slots[index].len; }
+
+    private:
+        struct slot {
+            bool used;
+            std::uint64_t address;
+            hw_breakpoint_type type;
+            std::size_t len;
+        };
+
+        static int encode_length(std::size_t len) {
+            switch (len) {
+                case 1: return 0;
+                case 2: return 1;
+                case 8: return 2;
+                case 4: return 3;
+                default: return -1;
+            }
+        }
+
+        //enable, RW and LEN bits of one slot
+        static std::uint64_t control_mask(std::size_t index) {
+            return (3ull << (index * 2)) | (0xfull << (16 + index * 4));
+        }
+
+        static std::size_t offset(std::size_t reg) {
+            return offsetof(struct user, u_debugreg) + reg * sizeof(std::uint64_t);
+        }
+
+        bool poke(pid_t tid, std::size_t reg, std::uint64_t value) {
+            count_ptrace(PTRACE_POKEUSER);
+            return ptrace(PTRACE_POKEUSER, tid, offset(reg), value) == 0;
+        }
+
+        //fails if the main thread refuses; the others may be on their way out
+        bool poke_all(std::size_t reg, std::uint64_t value) {
+            auto ok = true;
+            for (auto tid : m_tids) {
+                if (!poke(tid, reg, value) && tid == m_tids.front()) ok = false;
+            }
+            return ok;
+        }
+
+        std::vector<pid_t> m_tids; //main thread first
+        std::uint64_t m_dr7 = 0;
+        std::array<slot, n_slots> m_slots{};
+    };
+}
+
+#endif
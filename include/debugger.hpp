@@ -2,54 +2,60 @@
 #define MINIDBG_DEBUGGER_HPP
 
 #include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <iostream>
 #include <signal.h>
-#include <fcntl.h>
 
 #include "dwarf/dwarf++.hh"
 #include "elf/elf++.hh"
 
 #include "breakpoint.hpp"
+#include "debug_registers.hpp"
+#include "displaced_step.hpp"
+#include "registers.hpp"
+#include "threads.hpp"
+#include "stop_event.hpp"
+#include "program_image.hpp"
+#include "symbols.hpp"
+#include "coverage_sink.hpp"
+#include "variable_locations.hpp"
+#include "profiler.hpp"
+#include "process_map.hpp"
+#include "breakpoint_condition.hpp"
+#include "block_map.hpp"
 
 namespace minidbg {
-    enum class symbol_type {
-        notype,            // No type (e.g., absolute symbol)
-        object,            // Data object
-        func,              // Function entry point
-        section,           // Symbol is associated with a section
-        file,              // Source file associated with the
-    };                     // object file
-
-    std::string to_string (symbol_type st) {
-        switch (st) {
-        case symbol_type::notype: return "notype";
-        case symbol_type::object: return "object";
-        case symbol_type::func: return "func";
-        case symbol_type::section: return "section";
-        case symbol_type::file: return "file";
-        }
-    }
-
-    struct symbol {
-        symbol_type type;
-        std::string name;
-        std::uintptr_t addr;
+    enum class coverage_mode {
+        step,              // Single step every instruction (runAdvice)
+        step_user,         // Single step user code, run library code at full speed
+        block,             // Like step_user, but stop only at branches (PTRACE_SINGLEBLOCK)
+        line,              // Breakpoint on every line, count every hit
+        first_hit,         // Breakpoint on every line, removed after first hit
+        profile,           // Run free, sampling the stack at a fixed rate
     };
 
     class debugger {
     public:
-        debugger (std::string prog_name, pid_t pid)
-            : m_prog_name{std::move(prog_name)}, m_pid{pid} {
-                auto fd = open(m_prog_name.c_str(), O_RDONLY);
+        debugger (std::shared_ptr<const program_image> image, pid_t pid, std::ostream& out = std::cout)
+            : m_image{std::move(image)}, m_pid{pid}, m_memory{pid}, m_debug_registers{pid}, m_out{out} {
+            m_thread = &m_threads.emplace(pid, traced_thread{pid, true}).first->second;
+            line_counts.resize(m_image->line_count());
+        }
 
-                m_elf = elf::elf{elf::create_mmap_loader(fd)};
-                m_dwarf = dwarf::dwarf{dwarf::elf::create_loader(m_elf)};
-            }
+        debugger (std::string prog_name, pid_t pid, std::ostream& out = std::cout)
+            : debugger{std::make_shared<const program_image>(std::move(prog_name)), pid, out} {}
 
         void run();
         void dump_registers();
         auto read_memory(uint64_t address) -> uint64_t;
+        auto read_memory(uint64_t address, std::size_t len, void* buffer) -> std::size_t;
         void write_memory(uint64_t address, uint64_t value);
+        bool write_memory(uint64_t address, std::size_t len, const void* buffer);
+        void dump_memory(uint64_t address, std::size_t len);
         void print_backtrace();
         void read_variables();
         void continue_execution();
@@ -59,34 +65,121 @@ namespace minidbg {
         void step_over();
         auto get_signal_info() -> siginfo_t;
         void remove_breakpoint(std::intptr_t addr);
-        void set_breakpoint_at_function(const std::string& name);
+        auto set_breakpoint_at_function(const std::string& name) -> std::vector<std::intptr_t>;
         void set_breakpoint_at_address(std::intptr_t addr);
-        void set_breakpoint_at_source_line(const std::string& file, unsigned line);
+        void set_breakpoints_at_addresses(const std::vector<std::intptr_t>& addrs);
+        void remove_breakpoints(const std::vector<std::intptr_t>& addrs);
+        auto set_breakpoint_at_source_line(const std::string& file, unsigned line) -> std::vector<std::intptr_t>;
+        //breakpoints at addrs only stop once their condition holds and ignore_count hits have passed
+        void set_breakpoint_filter(const std::vector<std::intptr_t>& addrs, unsigned ignore_count, const std::string& condition);
+        void set_watchpoint(uint64_t address, std::size_t len, const std::string& name);
+        void set_watchpoint_on_variable(const std::string& name);
         void print_source(const std::string& file_name, unsigned line, unsigned n_lines_context=2);
         auto lookup_symbol(const std::string&) -> std::vector<symbol>;
 
-        std::map<int,int> source_map;
-        void runAdvice();
+        std::vector<std::uint32_t> line_counts; //hits by line_id, shared by all threads
+        void runAdvice(bool fast_forward = false);
         void step_in_advice();
-        void print_source_advice(const std::string& file_name, unsigned line, unsigned n_lines_context=2);
+        void print_source_advice(const line_row& row);
+        void run_line_coverage(bool first_hit_only);
+        void run_block_coverage();
+        void run_profile(unsigned rate, sample_ring& samples);
+        void set_sink(coverage_sink& sink) { m_sink = &sink; }
+        //the debuggee is a fork server clone: already stopped at main's first instruction, with its options set
+        void set_started_at_main() { m_started_at_main = true; }
+        //dump the current function's variables each time a new line is reached
+        void set_trace_variables(bool trace) { m_trace_variables = trace; }
+        //takes over the already running process with PTRACE_SEIZE, for any of the run modes after it.
+        //false if some thread isn't stopped within timeout
+        bool attach(std::chrono::microseconds timeout);
+        //puts back everything that was patched and lets the process go on untraced
+        void detach(std::chrono::microseconds timeout);
+        //from any thread: makes the run in progress return at its next stop, and forces one
+        void request_detach();
 
 
     private:
         void single_step_instruction(); //single step without checking breakpoints
         void step_over_breakpoint();
+        bool displaced_step(const breakpoint& bp);
+        auto get_displaced_instruction(const breakpoint& bp) -> const displaced_instruction&;
+        bool scratch_pad_usable(std::size_t len);
         void handle_command(const std::string& line);
         void handle_sigtrap(siginfo_t info);
-        void wait_for_signal();
+        void handle_breakpoint_hit();
+        void report_watchpoint(int slot);
+        bool filter_passes(breakpoint_filter& filter);
+        bool condition_holds(const breakpoint_condition& cond);
+        bool compile_condition(std::intptr_t addr, const std::string& text, breakpoint_condition& cond, std::string& error);
+        void record_sample();
+        bool at_hardware_breakpoint();
+        void set_resume_flag();
+        bool find_variable(const std::string& name, uint64_t& address, std::size_t& size);
+        auto get_function_variables(const dwarf::die& func) -> const function_variables&;
+        auto locate_variable(const function_variables& frame, const local_variable& var) -> variable_place;
+        void wait_for_start();
+        void wait_for_signal(pid_t tid = -1);
+        bool handle_thread_event(const stop_event& event);
+        int infer_trap_code();
+        void add_thread(pid_t tid);
+        void remove_thread(pid_t tid);
+        bool resume(traced_thread& thread, __ptrace_request request);
+        void run_to_main();
+        void block_step();
+        void account_block(const siginfo_t& info);
+        bool probe_block_step();
+        void save_scratch_pad();
         auto get_pc() -> uint64_t;
         void set_pc(uint64_t pc);
         auto get_line_entry_from_pc(uint64_t pc) -> dwarf::line_table::iterator;
+        auto get_line_from_pc(uint64_t pc) -> const line_row&;
         auto get_function_from_pc(uint64_t pc) -> dwarf::die;
-
-        std::string m_prog_name;
+        auto get_call_stack(std::size_t depth) -> const std::vector<stack_frame>&;
+        auto get_return_address() -> uint64_t;
+        void set_breakpoints_on_all_lines();
+        auto get_step_over_sites(const dwarf::die& func) -> const std::vector<std::intptr_t>&;
+        bool has_line_info(uint64_t pc);
+        void fast_forward_to_user_code();
+        bool finished() const { return m_exited || m_detach_requested.load(std::memory_order_relaxed); }
+        auto get_scratch_pad() -> uint64_t;
+        bool wait_for_threads(std::unordered_set<pid_t>& pending, std::chrono::steady_clock::time_point deadline);
+        void release_threads(pid_t except);
+
+        std::shared_ptr<const program_image> m_image;
         pid_t m_pid;
-        dwarf::dwarf m_dwarf;
-        elf::elf m_elf;
+        process_memory m_memory;
+        std::unordered_map<pid_t,traced_thread> m_threads; //by tid, the main thread's is m_pid
+        traced_thread* m_thread; //the stopped thread we're working with, every other one is running
+        __ptrace_request m_new_thread_request = PTRACE_CONT; //how threads are resumed after their first stop
+        debug_registers m_debug_registers;
+        std::unordered_map<int,watchpoint> m_watchpoints; //by debug register slot
+        std::ostream& m_out; //coverage output, so parallel runs can each buffer their own
         std::unordered_map<std::intptr_t,breakpoint> m_breakpoints;
+        std::unordered_map<std::intptr_t,breakpoint_filter> m_breakpoint_filters; //conditions and ignore counts by address
+        std::unordered_set<std::intptr_t> m_step_targets; //where the next or finish in progress stops, filters or not
+        std::unordered_map<dwarf::taddr,std::vector<std::intptr_t>> m_step_over_sites; //line addresses by function entry
+        std::unordered_map<dwarf::taddr,function_variables> m_function_variables; //decoded locations by function entry
+        std::unordered_map<std::intptr_t,displaced_instruction> m_displaced; //decoded copies by breakpoint address
+        std::intptr_t m_scratch_contents = 0; //breakpoint whose copy is in the scratch pad
+        std::vector<uint8_t> m_scratch_original; //what the scratch pad held, to put back on detach
+        std::unique_ptr<block_map> m_blocks; //while block stepping: the lines each block covers
+        uint64_t m_load_bias = 0; //add to a DWARF address for where it is in the debuggee: 0 unless PIE
+        std::size_t m_line_hint = 0;
+        std::size_t m_function_hint = 0;
+        std::size_t m_frame_hint = 0;
+        bool m_first_hit_only = false;
+        bool m_skip_stop = false; //the last breakpoint hit was filtered out: carry on as if it hadn't happened
+        bool m_exited = false;
+        bool m_entry_breakpoints_set = false;
+        bool m_started_at_main = false;
+        bool m_trace_variables = false;
+        bool m_attached = false;
+        bool m_holding_threads = false; //all stopped since attaching, until the first resume
+        std::chrono::steady_clock::time_point m_attach_started;
+        std::atomic<bool> m_detach_requested{false};
+        std::atomic<bool> m_waiting{false}; //in wait_for_signal, where a wake signal is swallowed
+        coverage_sink* m_sink = nullptr; //told about each new line when it asks to be
+        sample_ring* m_samples = nullptr; //where profile samples go, while profiling
 
 
 
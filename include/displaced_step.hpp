@@ -0,0 +1,231 @@
+#ifndef MINIDBG_DISPLACED_STEP_HPP
+#define MINIDBG_DISPLACED_STEP_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace minidbg {
+    //an instruction copied out of line so it can run while its breakpoint stays armed
+    struct displaced_instruction {
+        enum class kind {
+            unsupported,       // couldn't decode it, or it can't run elsewhere
+            plain,             // runs as is from the scratch pad, falls through to addr + len
+            call_indirect,     // runs from the scratch pad, pushed return address needs fixing
+            branch,            // conditional relative branch, rewritten to land just past the copy
+            jump,              // relative jump, emulated
+            call,              // relative call, emulated
+        };
+
+        kind type = kind::unsupported;
+        std::size_t len = 0;
+        std::array<std::uint8_t, 16> bytes{}; //copy to place in the scratch pad
+        std::uint64_t target = 0;              //where a relative branch goes in its original place
+        bool ends_block = false;               //always transfers control: jumps, calls and returns
+
+        //where a rewritten conditional branch lands in the scratch pad when taken
+        static constexpr std::size_t taken_offset = 1;
+    };
+
+    //decodes the x86-64 instruction in code, as found at address, and prepares a copy
+    //for execution at scratch: RIP-relative memory operands and relative branches are
+    //rewritten so that they still refer to the original locations
+    inline displaced_instruction prepare_displaced_instruction(const std::uint8_t* code, std::size_t avail,
+                                                               std::uint64_t address, std::uint64_t scratch) {
+        displaced_instruction insn{};
+        std::size_t i = 0;
+        bool opsize = false, addrsize = false, rex_w = false;
+        auto fail = [] { return displaced_instruction{}; };
+        auto need = [&](std::size_t n) { return i + n <= avail && i + n <= 15; };
+
+        //legacy prefixes, then REX which has to come straight before the opcode
+        while (need(1)) {
+            auto b = code[i];
+            if (b == 0x66) opsize = true;
+            else if (b == 0x67) addrsize = true;
+            else if (b == 0xf0 || b == 0xf2 || b == 0xf3 || b == 0x2e || b == 0x36 ||
+                     b == 0x3e || b == 0x26 || b == 0x64 || b == 0x65) {}
+            else break;
+            ++i;
+        }
+        if (need(1) && (code[i] & 0xf0) == 0x40) {
+            rex_w = code[i] & 0x08;
+            ++i;
+        }
+        if (!need(1)) return fail();
+
+        enum class imm { none, b1, b2, z, v, b2b1, moffs, rel8, rel32 };
+        bool modrm = false;
+        auto immediate = imm::none;
+        int map = 0;            // 0: one byte, 1: 0f, 2: 0f38, 3: 0f3a
+        bool vex = false;
+        std::uint8_t op = code[i++];
+
+        if (op == 0xc4 || op == 0xc5 || op == 0x62) {
+            //VEX and EVEX: the prefix names the opcode map, and ModRM always follows
+            vex = true;
+            auto prefix_len = op == 0xc5 ? 1 : op == 0xc4 ? 2 : 3;
+            if (!need(prefix_len + 1)) return fail();
+            map = op == 0xc5 ? 1 : (code[i] & (op == 0xc4 ? 0x1f : 0x07));
+            i += prefix_len;
+            op = code[i++];
+            modrm = !(map == 1 && op == 0x77); //vzeroupper/vzeroall
+            if (map == 3 || (map == 1 && ((op >= 0x70 && op <= 0x73) || op == 0xc2 || (op >= 0xc4 && op <= 0xc6)))) {
+                immediate = imm::b1;
+            }
+        } else if (op == 0x0f) {
+            if (!need(1)) return fail();
+            op = code[i++];
+            if (op == 0x38 || op == 0x3a) {
+                if (!need(1)) return fail();
+                map = op == 0x38 ? 2 : 3;
+                    op = code[i++];
+                modrm = true;
+                if (map == 3) immediate = imm::b1;
+            } else {
+                map = 1;
+                modrm = !((op >= 0x05 && op <= 0x09) || op == 0x0b || op == 0x0e || (op >= 0x30 && op <= 0x37) ||
+                          op == 0x77 || (op >= 0x80 && op <= 0x8f) || op == 0xa0 || op == 0xa1 || op == 0xa2 ||
+                          op == 0xa8 || op == 0xa9 || op == 0xaa || (op >= 0xc8 && op <= 0xcf));
+                if ((op >= 0x70 && op <= 0x73) || op == 0xa4 || op == 0xac || op == 0xba || op == 0xc2 ||
+                    (op >= 0xc4 && op <= 0xc6) || op == 0x0f) {
+                    immediate = imm::b1;
+                }
+                if (op >= 0x80 && op <= 0x8f) immediate = imm::rel32;
+            }
+        } else {
+            auto lo = op & 0x07;
+            if (op < 0x40) {
+                if ((op & 0x07) == 0x06 || (op & 0x07) == 0x07) return fail(); //invalid in 64 bit mode
+                if (lo < 4) modrm = true;
+                else if (lo == 4) immediate = imm::b1;
+                else immediate = imm::z;
+            } else if (op >= 0x50 && op <= 0x5f) {
+            } else if (op == 0x63) { modrm = true; }
+            else if (op == 0x68) { immediate = imm::z; }
+            else if (op == 0x69) { modrm = true; immediate = imm::z; }
+            else if (op == 0x6a) { immediate = imm::b1; }
+            else if (op == 0x6b) { modrm = true; immediate = imm::b1; }
+            else if (op >= 0x6c && op <= 0x6f) {}
+            else if (op >= 0x70 && op <= 0x7f) { immediate = imm::rel8; }
+            else if (op == 0x80 || op == 0x83) { modrm = true; immediate = imm::b1; }
+            else if (op == 0x81) { modrm = true; immediate = imm::z; }
+            else if (op >= 0x84 && op <= 0x8f) { modrm = true; }
+            else if (op >= 0x90 && op <= 0x9f && op != 0x9a) {}
+            else if (op >= 0xa0 && op <= 0xa3) { immediate = imm::moffs; }
+            else if (op >= 0xa4 && op <= 0xa7) {}
+            else if (op == 0xa8) { immediate = imm::b1; }
+            else if (op == 0xa9) { immediate = imm::z; }
+            else if (op >= 0xaa && op <= 0xaf) {}
+            else if (op >= 0xb0 && op <= 0xb7) { immediate = imm::b1; }
+            else if (op >= 0xb8 && op <= 0xbf) { immediate = imm::v; }
+            else if (op == 0xc0 || op == 0xc1 || op == 0xc6) { modrm = true; immediate = imm::b1; }
+            else if (op == 0xc2 || op == 0xca) { immediate = imm::b2; }
+            else if (op == 0xc3 || op == 0xc9 || op == 0xcb || op == 0xcc || op == 0xcf) {}
+            else if (op == 0xc7) { modrm = true; immediate = imm::z; }
+            else if (op == 0xc8) { immediate = imm::b2b1; }
+            else if (op == 0xcd) { immediate = imm::b1; }
+            else if ((op >= 0xd0 && op <= 0xd3) || (op >= 0xd8 && op <= 0xdf)) { modrm = true; }
+            else if (op == 0xd7) {}
+            else if (op >= 0xe0 && op <= 0xe3) { immediate = imm::rel8; }
+            else if (op >= 0xe4 && op <= 0xe7) { immediate = imm::b1; }
+            else if (op == 0xe8 || op == 0xe9) { immediate = imm::rel32; }
+            else if (op == 0xeb) { immediate = imm::rel8; }
+            else if (op >= 0xec && op <= 0xef) {}
+            else if (op == 0xf1 || op == 0xf4 || op == 0xf5 || (op >= 0xf8 && op <= 0xfd)) {}
+            else if (op == 0xf6 || op == 0xf7 || op == 0xfe || op == 0xff) { modrm = true; }
+            else return fail();
+        }
+
+        std::size_t rip_disp_pos = 0;
+        std::uint8_t modrm_byte = 0;
+        if (modrm) {
+            if (!need(1)) return fail();
+            modrm_byte = code[i++];
+            auto mod = modrm_byte >> 6;
+            auto rm = modrm_byte & 0x07;
+            if (mod != 3) {
+                if (rm == 4) {
+                    if (!need(1)) return fail();
+                    auto sib = code[i++];
+                    if (mod == 0 && (sib & 0x07) == 5) i += 4;
+                } else if (mod == 0 && rm == 5) {
+                    rip_disp_pos = i;
+                    i += 4;
+                }
+                if (mod == 1) i += 1;
+                if (mod == 2) i += 4;
+            }
+
+            //test is the one group whose immediate depends on the reg field
+            if (!vex && map == 0 && (op == 0xf6 || op == 0xf7) && ((modrm_byte >> 3) & 0x07) < 2) {
+                immediate = op == 0xf6 ? imm::b1 : imm::z;
+            }
+        }
+
+        std::size_t rel_pos = 0, rel_size = 0;
+        switch (immediate) {
+            case imm::none: break;
+            case imm::b1: i += 1; break;
+            case imm::b2: i += 2; break;
+            case imm::z: i += opsize ? 2 : 4; break;
+            case imm::v: i += rex_w ? 8 : opsize ? 2 : 4; break;
+            case imm::b2b1: i += 3; break;
+            case imm::moffs: i += addrsize ? 4 : 8; break;
+            case imm::rel8: rel_pos = i; rel_size = 1; i += 1; break;
+            case imm::rel32: rel_pos = i; rel_size = 4; i += 4; break;
+        }
+        if (i > avail || i > 15) return fail();
+
+        insn.len = i;
+        std::memcpy(insn.bytes.data(), code, i);
+
+        //xbegin carries a relative abort address we can't redirect
+        if (!vex && map == 0 && op == 0xc7 && modrm_byte == 0xf8) return fail();
+
+        if (rel_size) {
+            std::int64_t rel = rel_size == 1 ? static_cast<std::int8_t>(code[rel_pos])
+                                             : [&] { std::int32_t r; std::memcpy(&r, code + rel_pos, 4); return r; }();
+            insn.target = address + insn.len + rel;
+
+            if (map == 0 && op == 0xe8) {
+                insn.type = displaced_instruction::kind::call;
+                insn.ends_block = true;
+            } else if (map == 0 && (op == 0xe9 || op == 0xeb)) {
+                insn.type = displaced_instruction::kind::jump;
+                insn.ends_block = true;
+            } else {
+                //point the copy just past itself, so taken and not taken can be told apart
+                std::int32_t taken = displaced_instruction::taken_offset;
+                if (rel_size == 1) insn.bytes[rel_pos] = static_cast<std::uint8_t>(taken);
+                else std::memcpy(insn.bytes.data() + rel_pos, &taken, 4);
+                insn.type = displaced_instruction::kind::branch;
+            }
+            return insn;
+        }
+
+        if (rip_disp_pos) {
+            std::int32_t disp;
+            std::memcpy(&disp, code + rip_disp_pos, 4);
+            auto fixed = static_cast<std::int64_t>(disp) + static_cast<std::int64_t>(address - scratch);
+            if (fixed < std::numeric_limits<std::int32_t>::min() || fixed > std::numeric_limits<std::int32_t>::max()) {
+                return fail();
+            }
+            auto fixed32 = static_cast<std::int32_t>(fixed);
+            std::memcpy(insn.bytes.data() + rip_disp_pos, &fixed32, 4);
+        }
+
+        //call through a register or memory: ff /2
+        auto is_indirect_call = !vex && map == 0 && op == 0xff && ((modrm_byte >> 3) & 0x07) == 2;
+        insn.type = is_indirect_call ? displaced_instruction::kind::call_indirect : displaced_instruction::kind::plain;
+
+        //returns, and indirect and far calls and jumps: ff /2 to /5
+        auto reg_field = (modrm_byte >> 3) & 0x07;
+        insn.ends_block = !vex && map == 0 && (op == 0xc2 || op == 0xc3 || op == 0xca || op == 0xcb || op == 0xcf ||
+                                                (op == 0xff && reg_field >= 2 && reg_field <= 5));
+        return insn;
+    }
+}
+
+#endif
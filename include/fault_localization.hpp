@@ -0,0 +1,124 @@
+#ifndef MINIDBG_FAULT_LOCALIZATION_HPP
+#define MINIDBG_FAULT_LOCALIZATION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "line_set.hpp"
+
+namespace minidbg {
+    enum class suspiciousness {
+        ochiai,            // ef / sqrt(F * (ef + ep))
+        tarantula,         // (ef / F) / (ef / F + ep / P)
+        dstar,             // ef^2 / (ep + F - ef)
+    };
+
+    //a line's place in the ranking, with the counts the score came from
+    struct line_score {
+        std::size_t id;
+        double score;
+        std::uint32_t failed;   // failing tests which ran the line
+        std::uint32_t passed;   // passing tests which ran the line
+    };
+
+    //bit per (line, test): one row of test bits per line, so the per line counts are popcounts
+    //of a row masked with the failed tests, which run word by word over contiguous memory
+    class coverage_matrix {
+    public:
+        coverage_matrix(std::size_t n_lines, std::size_t n_tests)
+            : m_n_lines{n_lines}, m_words{(n_tests + 63) / 64}, m_bits(n_lines * m_words), m_failed(m_words) {}
+
+        void add_test(std::size_t test, bool passed, const line_set& covered) {
+            auto word = test / 64;
+            auto bit = std::uint64_t{1} << (test % 64);
+            covered.for_each([&](std::size_t id) {
+                if (id < m_n_lines) m_bits[id * m_words + word] |= bit;
+            });
+            if (!passed) {
+                m_failed[word] |= bit;
+                ++m_n_failed;
+            } else {
+                ++m_n_passed;
+            }
+        }
+
+        //failing tests are ranked on their own: the score only needs F and P as totals
+        auto rank(suspiciousness formula, unsigned jobs) const -> std::vector<line_score> {
+            std::vector<line_score> scores(m_n_lines);
+            jobs = std::max(1u, std::min<unsigned>(jobs, m_n_lines / 1024 + 1));
+
+            auto score_range = [&](std::size_t first, std::size_t last) {
+                for (auto id = first; id < last; ++id) {
+                    auto row = &m_bits[id * m_words];
+                    std::uint32_t failed = 0, ran = 0;
+                    for (std::size_t w = 0; w < m_words; ++w) {
+                        failed += __builtin_popcountll(row[w] & m_failed[w]);
+                        ran += __builtin_popcountll(row[w]);
+                    }
+                    auto passed = ran - failed;
+                    scores[id] = line_score{id, score(formula, failed, passed), failed, passed};
+                }
+            };
+
+            std::vector<std::thread> workers;
+            auto chunk = (m_n_lines + jobs - 1) / jobs;
+            for (unsigned j = 1; j < jobs; ++j) {
+                workers.emplace_back(score_range, std::min(m_n_lines, j * chunk), std::min(m_n_lines, (j + 1) * chunk));
+            }
+            score_range(0, std::min(m_n_lines, chunk));
+            for (auto& w : workers) {
+                w.join();
+            }
+
+            //only lines some failing test ran are candidates; ties keep line order
+            scores.erase(std::remove_if(scores.begin(), scores.end(), [](const line_score& s) { return s.failed == 0; }),
+                         scores.end());
+            std::stable_sort(scores.begin(), scores.end(),
+                             [](const line_score& a, const line_score& b) { return a.score > b.score; });
+            return scores;
+        }
+
+    private:
+        auto score(suspiciousness formula, double ef, double ep) const -> double {
+            double total_failed = m_n_failed, total_passed = m_n_passed;
+            if (ef == 0) return 0;
+
+            switch (formula) {
+                case suspiciousness::ochiai:
+                    return ef / std::sqrt(total_failed * (ef + ep));
+                case suspiciousness::tarantula: {
+                    auto fail_ratio = ef / total_failed;
+                    auto pass_ratio = total_passed > 0 ? ep / total_passed : 0;
+                    return fail_ratio / (fail_ratio + pass_ratio);
+                }
+                case suspiciousness::dstar: {
+                    auto denominator = ep + (total_failed - ef);
+                    return denominator > 0 ? ef * ef / denominator : std::numeric_limits<double>::infinity();
+                }
+            }
+            return 0;
+        }
+
+        std::size_t m_n_lines;
+        std::size_t m_words;                //words per row
+        std::vector<std::uint64_t> m_bits;  //m_n_lines rows of m_words
+        std::vector<std::uint64_t> m_failed;
+        std::size_t m_n_failed = 0;
+        std::size_t m_n_passed = 0;
+    };
+
+    inline bool parse_suspiciousness(const std::string& name, suspiciousness& formula) {
+        if (name == "ochiai") formula = suspiciousness::ochiai;
+        else if (name == "tarantula") formula = suspiciousness::tarantula;
+        else if (name == "dstar") formula = suspiciousness::dstar;
+        else return false;
+        return true;
+    }
+}
+
+#endif
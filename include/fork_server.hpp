@@ -0,0 +1,253 @@
+#ifndef MINIDBG_FORK_SERVER_HPP
+#define MINIDBG_FORK_SERVER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "process_map.hpp"
+#include "process_memory.hpp"
+#include "program_image.hpp"
+#include "stats.hpp"
+
+namespace minidbg {
+    //runs the debuggee once, up to main's first instruction, and keeps it stopped there. each test then gets a clone of that process instead of a fork, exec, dynamic link and
+    //run up to main of its own. clones are made by having the stopped process call clone itself
+    class fork_server {
+    public:
+        explicit fork_server(std::shared_ptr<const program_image> image) : m_image{std::move(image)} {}
+
+        ~fork_server() {
+            if (m_pid > 0) {
+                kill(m_pid, SIGKILL);
+                waitpid(m_pid, nullptr, __WALL);
+            }
+        }
+
+        fork_server(const fork_server&) = delete;
+        fork_server& operator=(const fork_server&) = delete;
+
+        //runs the program from work_dir, or the current directory if empty, until it reaches main.
+        //false, with error() saying why, if it never gets there or runs user code on the way
+        bool start(const std::string& work_dir) {
+            auto main_address = find_main();
+            if (!main_address) return fail("no main with line information");
+
+            const auto& prog = m_image->get_path();
+            auto pid = fork();
+            if (pid == 0) {
+                if (!work_dir.empty() && chdir(work_dir.c_str()) < 0) _exit(1);
+                if (ptrace(PTRACE_TRACEME, 0, 0, 0) < 0) _exit(1);
+                execl(prog.c_str(), prog.c_str(), nullptr);
+                _exit(1);
+            } else if (pid < 0) {
+                return fail("fork failed");
+            }
+            m_pid = pid;
+
+            int status;
+            if (!wait_stop(pid, status)) return fail("the program didn't start");
+            count_ptrace(PTRACE_SETOPTIONS);
+            ptrace(PTRACE_SETOPTIONS, pid, nullptr, PTRACE_O_TRACEFORK | PTRACE_O_EXITKILL);
+
+            //a PIE is only placed at exec; clones keep the server's layout
+            auto bias = find_load_bias(pid, m_image->get_elf());
+            m_syscall_address = m_image->get_elf().get_hdr().entry + bias;
+
+            //every function with line information gets a breakpoint, not just main: a clone can't run
+            //user code which ran before main again, so its coverage would be missing lines
+            process_memory memory{pid};
+            auto entries = m_image->get_function_entries();
+            if (std::find(entries.begin(), entries.end(), main_address) == entries.end()) entries.push_back(main_address);
+            std::vector<std::uint8_t> saved(entries.size());
+            const std::uint8_t int3 = 0xcc;
+            for (std::size_t i = 0; i < entries.size(); ++i) {
+                entries[i] += bias;
+                if (memory.read(entries[i], &saved[i], 1) != 1 || !memory.write(entries[i], &int3, 1)) {
+                    return fail("can't set breakpoints");
+                }
+            }
+            main_address += bias;
+
+            count_ptrace(PTRACE_CONT);
+            ptrace(PTRACE_CONT, pid, nullptr, nullptr);
+            if (!wait_stop(pid, status) || WSTOPSIG(status) != SIGTRAP) return fail("the program never reached main");
+            count_ptrace(PTRACE_GETREGS);
+            ptrace(PTRACE_GETREGS, pid, nullptr, &m_regs);
+            if (m_regs.rip - 1 != main_address) return fail("user code runs before main");
+            for (std::size_t i = 0; i < entries.size(); ++i) {
+                memory.write(entries[i], &saved[i], 1);
+            }
+            m_regs.rip = main_address;
+
+            //injected calls run from the entry point, as displaced steps do. clones inherit it
+            const std::uint8_t syscall_insn[] = {0x0f, 0x05};
+            if (!memory.write(m_syscall_address, syscall_insn, sizeof(syscall_insn))) return fail("can't write the entry point");
+            m_running = true;
+            return true;
+        }
+
+        bool running() const { return m_running; }
+
+        auto error() const -> const std::string& { return m_error; }
+
+        //a new process stopped at main, traced by the calling thread, with args as its argv and
+        //input_fd and output_fd, where not -1, as its stdin and stdout. -1 on failure
+        pid_t spawn(const std::vector<std::string>& args, int input_fd, int output_fd) {
+            if (!m_running) return -1;
+
+            //CLONE_PARENT makes the clone our child rather than the server's, so its exit is ours to reap
+            auto child = static_cast<pid_t>(inject_syscall(m_pid, SYS_clone, {CLONE_PARENT | SIGCHLD, 0, 0, 0, 0}));
+            if (child <= 0) return -1;
+
+            int status;
+            if (!wait_stop(child, status) || !set_up_clone(child, args, input_fd, output_fd)) {
+                kill(child, SIGKILL);
+                waitpid(child, nullptr, __WALL);
+                return -1;
+            }
+            return child;
+        }
+
+    private:
+        bool fail(const std::string& why) {
+            m_error = why;
+            return false;
+        }
+
+        //main's first instruction, as linked: before the prologue, which at -O0 copies argc and argv
+        //to the stack, so a clone's own ones can still be handed over in rdi and rsi
+        auto find_main() const -> std::uint64_t {
+            auto names = m_image->lookup_name("main");
+            if (!names) return 0;
+
+            for (const auto& die : names->functions) {
+                std::size_t hint = 0;
+                if (m_image->find_line_entry(at_low_pc(die), hint)) return at_low_pc(die);
+            }
+            return 0;
+        }
+
+        static bool wait_stop(pid_t pid, int& status) {
+            return timed_waitpid(pid, &status, __WALL) == pid && WIFSTOPPED(status);
+        }
+
+        //runs one system call in the stopped process pid and leaves its registers as they were.
+        //returns what the call returned, -errno included
+        auto inject_syscall(pid_t pid, long nr, std::initializer_list<std::uint64_t> args) -> long {
+            user_regs_struct saved, regs;
+            count_ptrace(PTRACE_GETREGS);
+            ptrace(PTRACE_GETREGS, pid, nullptr, &saved);
+
+            regs = saved;
+            regs.rax = nr;
+            regs.orig_rax = -1;
+            regs.rip = m_syscall_address;
+            unsigned long long* arg_regs[] = {&regs.rdi, &regs.rsi, &regs.rdx, &regs.r10, &regs.r8, &regs.r9};
+            auto n = 0;
+            for (auto arg : args) {
+                *arg_regs[n++] = arg;
+            }
+            count_ptrace(PTRACE_SETREGS);
+            ptrace(PTRACE_SETREGS, pid, nullptr, &regs);
+
+            //a clone is reported as an event stop before the call returns
+            int status;
+            do {
+                count_ptrace(PTRACE_SINGLESTEP);
+                ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr);
+                if (!wait_stop(pid, status)) return -ESRCH;
+            } while ((status >> 16) != 0 || WSTOPSIG(status) != SIGTRAP);
+
+            count_ptrace(PTRACE_GETREGS);
+            ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
+            count_ptrace(PTRACE_SETREGS);
+            ptrace(PTRACE_SETREGS, pid, nullptr, &saved);
+            return static_cast<long>(regs.rax);
+        }
+
+        //the clone starts as a copy of the server: give it its own argv, stdin and stdout, then put it
+        //back at main's entry. the new argv goes in a fresh mapping rather than over the server's, so any
+        //arguments fit; main is handed it through argc and argv as it would be by the loader
+        bool set_up_clone(pid_t child, const std::vector<std::string>& args, int input_fd, int output_fd) {
+            //the debuggee's own forks aren't ours to follow, as with an exec'd debuggee
+            count_ptrace(PTRACE_SETOPTIONS);
+            ptrace(PTRACE_SETOPTIONS, child, nullptr, PTRACE_O_TRACECLONE);
+
+            struct redirect {
+                int to;
+                int flags;
+                std::size_t path;
+            };
+            std::vector<redirect> redirects;
+            std::string data;
+            std::vector<std::size_t> arg_offsets;
+            for (const auto& arg : args) {
+                arg_offsets.push_back(data.size());
+                data.append(arg.c_str(), arg.size() + 1);
+            }
+            //the clone reopens our descriptors through /proc: it can't be handed them directly
+            auto add_redirect = [&](int from, int to, int flags) {
+                if (from < 0) return;
+                redirects.push_back(redirect{to, flags, data.size()});
+                auto path = "/proc/" + std::to_string(getpid()) + "/fd/" + std::to_string(from);
+                data.append(path.c_str(), path.size() + 1);
+            };
+            add_redirect(input_fd, STDIN_FILENO, O_RDONLY);
+            add_redirect(output_fd, STDOUT_FILENO, O_WRONLY);
+            data.resize((data.size() + 7) & ~std::size_t{7});
+
+            auto argv_offset = data.size();
+            auto size = argv_offset + (args.size() + 1) * sizeof(std::uint64_t);
+            auto region = static_cast<std::uint64_t>(inject_syscall(child, SYS_mmap,
+                {0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, static_cast<std::uint64_t>(-1), 0}));
+            if (region > static_cast<std::uint64_t>(-4096)) return false;
+
+            std::vector<std::uint64_t> argv;
+            for (auto offset : arg_offsets) {
+                argv.push_back(region + offset);
+            }
+            argv.push_back(0);
+            data.append(reinterpret_cast<const char*>(argv.data()), argv.size() * sizeof(std::uint64_t));
+
+            process_memory memory{child};
+            if (!memory.write(region, data.data(), data.size())) return false;
+
+            for (const auto& r : redirects) {
+                auto fd = inject_syscall(child, SYS_openat, {static_cast<std::uint64_t>(AT_FDCWD), region + r.path,
+                                                               static_cast<std::uint64_t>(r.flags)});
+                if (fd < 0) return false;
+                auto ok = inject_syscall(child, SYS_dup2, {static_cast<std::uint64_t>(fd), static_cast<std::uint64_t>(r.to)}) >= 0;
+                inject_syscall(child, SYS_close, {static_cast<std::uint64_t>(fd)});
+                if (!ok) return false;
+            }
+
+            auto regs = m_regs;
+            regs.rdi = args.size();
+            regs.rsi = region + argv_offset;
+            count_ptrace(PTRACE_SETREGS);
+            return ptrace(PTRACE_SETREGS, child, nullptr, &regs) == 0;
+        }
+
+        std::shared_ptr<const program_image> m_image;
+        pid_t m_pid = -1;
+        bool m_running = false;
+        std::string m_error;
+        user_regs_struct m_regs{}; //the server's registers at main's entry, which every clone starts from
+        std::uint64_t m_syscall_address = 0; //the entry point as loaded, where injected calls run
+    };
+}
+
+#endif
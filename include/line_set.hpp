@@ -0,0 +1,48 @@
+#ifndef MINIDBG_LINE_SET_HPP
+#define MINIDBG_LINE_SET_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace minidbg {
+    //set of line ids as a bitmap, one bit per line of the program
+    class line_set {
+    public:
+        line_set() = default;
+        explicit line_set(std::size_t n_lines) : m_words((n_lines + 63) / 64) {}
+
+        //the lines which ran at least once
+        static line_set from_counts(const std::vector<std::uint32_t>& counts) {
+            line_set set{counts.size()};
+            for (std::size_t id = 0; id < counts.size(); ++id) {
+                if (counts[id]) set.insert(id);
+            }
+            return set;
+        }
+
+        void insert(std::size_t id) {
+            if (id / 64 >= m_words.size()) m_words.resize(id / 64 + 1);
+            m_words[id / 64] |= std::uint64_t{1} << (id % 64);
+        }
+
+        bool contains(std::size_t id) const {
+            return id / 64 < m_words.size() && (m_words[id / 64] >> (id % 64)) & 1;
+        }
+
+        //calls f with every id in the set, in increasing order
+        template <class F>
+        void for_each(F f) const {
+            for (std::size_t i = 0; i < m_words.size(); ++i) {
+                for (auto word = m_words[i]; word; word &= word - 1) {
+                    f(i * 64 + __builtin_ctzll(word));
+                }
+            }
+        }
+
+    private:
+        std::vector<std::uint64_t> m_words;
+    };
+}
+
+#endif
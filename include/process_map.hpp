@@ -0,0 +1,71 @@
+#ifndef MINIDBG_PROCESS_MAP_HPP
+#define MINIDBG_PROCESS_MAP_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <climits>
+#include <unistd.h>
+
+#include "elf/elf++.hh"
+
+namespace minidbg {
+    //one line of /proc/pid/maps
+    struct mapped_region {
+        std::uint64_t start;
+        std::uint64_t end;
+        std::uint64_t offset; //of the start in the mapped file
+        std::string perms;
+        std::string path;     //empty for anonymous memory
+    };
+
+    inline std::vector<mapped_region> read_process_map(pid_t pid) {
+        std::vector<mapped_region> regions;
+        std::ifstream maps{"/proc/" + std::to_string(pid) + "/maps"};
+        std::string line;
+        while (std::getline(maps, line)) {
+            unsigned long long start, end, offset, inode;
+            char perms[8] = {};
+            unsigned major, minor;
+            int path_at = 0;
+            if (std::sscanf(line.c_str(), "%llx-%llx %7s %llx %x:%x %llu %n",
+                            &start, &end, perms, &offset, &major, &minor, &inode, &path_at) < 7) continue;
+
+            regions.push_back(mapped_region{start, end, offset, perms,
+                                            path_at > 0 ? line.substr(path_at) : std::string{}});
+        }
+        return regions;
+    }
+
+    //the program pid runs, named the way its regions are in the map
+    inline std::string process_executable(pid_t pid) {
+        char path[PATH_MAX];
+        auto n = readlink(("/proc/" + std::to_string(pid) + "/exe").c_str(), path, sizeof(path));
+        return n > 0 ? std::string(path, n) : std::string{};
+    }
+
+    //how far pid's program was moved from the addresses in its ELF and DWARF: 0 unless it's
+    //position independent. the mapping of the file's first page is where its first segment went
+    inline std::uint64_t find_load_bias(pid_t pid, const elf::elf& file) {
+        if (file.get_hdr().type != elf::et::dyn) return 0;
+
+        std::uint64_t link_base = 0;
+        for (const auto& seg : file.segments()) {
+            const auto& hdr = seg.get_hdr();
+            if (hdr.type == elf::pt::load && hdr.offset == 0) {
+                link_base = hdr.vaddr & ~std::uint64_t{0xfff};
+                break;
+            }
+        }
+
+        auto exe = process_executable(pid);
+        for (const auto& region : read_process_map(pid)) {
+            if (region.offset == 0 && region.path == exe) return region.start - link_base;
+        }
+        return 0;
+    }
+}
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef MINIDBG_PROCESS_MEMORY_HPP
+#define MINIDBG_PROCESS_MEMORY_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "stats.hpp"
+
+namespace minidbg {
+    //bulk access to the debuggee's address space, one syscall per range rather than per word
+    class process_memory {
+    public:
+        explicit process_memory(pid_t pid) : m_pid{pid} {}
+
+        ~process_memory() {
+            if (m_fd >= 0) close(m_fd);
+        }
+
+        process_memory(const process_memory&) = delete;
+        process_memory& operator=(const process_memory&) = delete;
+
+        //returns the number of bytes read, which is short if the range runs into unmapped memory
+        auto read(std::uint64_t address, void* buffer, std::size_t len) -> std::size_t {
+            iovec local{buffer, len};
+            iovec remote{reinterpret_cast<void*>(address), len};
+            ++get_tracer_stats().memory_calls;
+            auto n = process_vm_readv(m_pid, &local, 1, &remote, 1, 0);
+            std::size_t done = n > 0 ? n : 0;
+            if (done == len) return len;
+
+            //process_vm_readv honours page protections, /proc/pid/mem doesn't
+            ++get_tracer_stats().memory_calls;
+            auto m = pread(get_fd(), static_cast<char*>(buffer) + done, len - done, address + done);
+            return done + (m > 0 ? m : 0);
+        }
+
+        //several ranges with one process_vm_readv. false unless every one of them was read whole
+        bool read_scattered(iovec* local, iovec* remote, std::size_t n) {
+            if (n == 0) return true;
+
+            std::size_t total = 0;
+            for (std::size_t i = 0; i < n; ++i) {
+                total += local[i].iov_len;
+            }
+            ++get_tracer_stats().memory_calls;
+            if (process_vm_readv(m_pid, local, n, remote, n, 0) == static_cast<ssize_t>(total)) return true;
+
+            auto ok = true;
+            for (std::size_t i = 0; i < n; ++i) {
+                auto address = reinterpret_cast<std::uint64_t>(remote[i].iov_base);
+                ok = read(address, local[i].iov_base, local[i].iov_len) == local[i].iov_len && ok;
+            }
+            return ok;
+        }
+
+        //writes go through /proc/pid/mem so that read-only text can be patched
+        bool write(std::uint64_t address, const void* buffer, std::size_t len) {
+            ++get_tracer_stats().memory_calls;
+            auto n = pwrite(get_fd(), buffer, len, address);
+            if (n == static_cast<ssize_t>(len)) return true;
+
+            std::size_t done = n > 0 ? n : 0;
+            return poke(address + done, static_cast<const char*>(buffer) + done, len - done);
+        }
+
+    private:
+        int get_fd() {
+            //opened on first use: before that the child may not have exec'd yet, and the
+            //file keeps referring to whichever address space was current when it was opened
+            if (m_fd < 0) {
+                auto path = "/proc/" + std::to_string(m_pid) + "/mem";
+                m_fd = open(path.c_str(), O_RDWR);
+            }
+            return m_fd;
+        }
+
+        //word at a time fallback for kernels which refuse writes to /proc/pid/mem
+        bool poke(std::uint64_t address, const char* buffer, std::size_t len) {
+            while (len > 0) {
+                auto offset = address % sizeof(long);
+                auto word_address = address - offset;
+                auto n = std::min(len, sizeof(long) - offset);
+
+                errno = 0;
+                count_ptrace(PTRACE_PEEKDATA);
+                auto word = ptrace(PTRACE_PEEKDATA, m_pid, word_address, nullptr);
+                if (errno) return false;
+                std::memcpy(reinterpret_cast<char*>(&word) + offset, buffer, n);
+                count_ptrace(PTRACE_POKEDATA);
+                if (ptrace(PTRACE_POKEDATA, m_pid, word_address, word) < 0) return false;
+
+                address += n;
+                buffer += n;
+                len -= n;
+            }
+            return true;
+        }
+
+        pid_t m_pid;
+        int m_fd = -1;
+    };
+}
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef MINIDBG_PROFILER_HPP
+#define MINIDBG_PROFILER_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "program_image.hpp"
+
+namespace minidbg {
+    //the pcs of one interrupted call stack, innermost first
+    struct profile_sample {
+        static constexpr std::size_t max_depth = 64;
+
+        std::uint32_t depth = 0;
+        std::array<std::uint64_t, max_depth> pcs;
+    };
+
+    //fixed size queue for exactly one producer and one consumer thread. Capacity must be a power of two
+    template <class T, std::size_t Capacity>
+    class spsc_ring {
+        static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+    public:
+        //false if the ring is full; the item is dropped
+        bool push(const T& item) {
+            auto head = m_head.load(std::memory_order_relaxed);
+            if (head - m_tail.load(std::memory_order_acquire) == Capacity) return false;
+            m_items[head & (Capacity - 1)] = item;
+            m_head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop(T& item) {
+            auto tail = m_tail.load(std::memory_order_relaxed);
+            if (tail == m_head.load(std::memory_order_acquire)) return false;
+            item = m_items[tail & (Capacity - 1)];
+            m_tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        //on separate cache lines, so the two sides don't fight over one
+        alignas(64) std::atomic<std::size_t> m_head{0};
+        alignas(64) std::atomic<std::size_t> m_tail{0};
+        std::array<T, Capacity> m_items;
+    };
+
+    using sample_ring = spsc_ring<profile_sample, 256>;
+
+    //turns samples into per line counts and folded stacks on a thread of its own, so that all the
+    //tracer does while the debuggee is stopped is unwind and copy out the pcs
+    class profile_aggregator {
+    public:
+        //self samples are counted into line_counts, by the line of the innermost frame
+        profile_aggregator(const program_image& image, std::vector<std::uint32_t>& line_counts)
+            : m_image{image}, m_line_counts{line_counts} {}
+
+        ~profile_aggregator() { finish(); }
+
+        profile_aggregator(const profile_aggregator&) = delete;
+        profile_aggregator& operator=(const profile_aggregator&) = delete;
+
+        auto get_ring() -> sample_ring& { return m_ring; }
+
+        void start() {
+            m_thread = std::thread{[this] {
+                profile_sample sample;
+                while (true) {
+                    auto done = m_done.load(std::memory_order_acquire);
+                    auto any = false;
+                    while (m_ring.pop(sample)) {
+                        add(sample);
+                        any = true;
+                    }
+                    if (done) break;
+                    if (!any) std::this_thread::sleep_for(std::chrono::microseconds{200});
+                }
+            }};
+        }
+
+        //takes whatever is left in the ring and stops the thread
+        void finish() {
+            if (!m_thread.joinable()) return;
+            m_done.store(true, std::memory_order_release);
+            m_thread.join();
+        }
+
+        //"outer;...;inner" function names and how many samples stopped there
+        auto get_stacks() -> std::unordered_map<std::string, std::uint64_t>& { return m_stacks; }
+
+    private:
+        void add(const profile_sample& sample) {
+            if (sample.depth == 0) return;
+
+            if (auto row = m_image.find_line(sample.pcs[0], m_line_hint)) {
+                ++m_line_counts[row->id];
+            }
+
+            //callers' pcs are return addresses, which can be just past the end of the calling function
+            std::string stack;
+            for (auto i = sample.depth; i-- > 0;) {
+                auto pc = i == 0 ? sample.pcs[i] : sample.pcs[i] - 1;
+                auto func = m_image.find_function(pc, m_function_hint);
+                if (!stack.empty()) stack += ';';
+                stack += func ? dwarf::at_name(*func) : "??";
+            }
+            ++m_stacks[stack];
+        }
+
+        const program_image& m_image;
+        std::vector<std::uint32_t>& m_line_counts;
+        sample_ring m_ring;
+        std::unordered_map<std::string, std::uint64_t> m_stacks;
+        std::size_t m_line_hint = 0;
+        std::size_t m_function_hint = 0;
+        std::atomic<bool> m_done{false};
+        std::thread m_thread;
+    };
+}
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef MINIDBG_PROGRAM_IMAGE_HPP
+#define MINIDBG_PROGRAM_IMAGE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <map>
+#include <fcntl.h>
+
+#include "dwarf/dwarf++.hh"
+#include "elf/elf++.hh"
+
+#include "address_table.hpp"
+#include "call_frame.hpp"
+#include "source_cache.hpp"
+#include "symbols.hpp"
+
+namespace minidbg {
+    //dense number for a (file, line) pair, assigned in file then line order
+    using line_id = std::uint32_t;
+    constexpr line_id no_line = ~line_id{0};
+
+    struct source_location {
+        std::string file;
+        unsigned line;
+    };
+
+    //a line table row together with the source line it belongs to
+    struct line_row {
+        dwarf::line_table::iterator entry;
+        line_id id;
+    };
+
+    //everything the binary defines under one name
+    struct named_entities {
+        std::vector<symbol> symbols;       // symtab and dynsym entries
+        std::vector<dwarf::die> functions; // top level subprograms with code
+    };
+
+    //everything derived from the binary on disk. built once per program and shared between
+    //debuggers, so nothing in here may change after construction
+    class program_image {
+    public:
+        explicit program_image(std::string path) : m_path{std::move(path)} {
+            auto fd = open(m_path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::runtime_error{"Cannot open " + m_path};
+            }
+
+            m_elf = elf::elf{elf::create_mmap_loader(fd)};
+            m_dwarf = dwarf::dwarf{dwarf::elf::create_loader(m_elf)};
+            build_indexes();
+            m_call_frames.load(m_elf);
+        }
+
+        program_image(const program_image&) = delete;
+        program_image& operator=(const program_image&) = delete;
+
+        auto get_path() const -> const std::string& { return m_path; }
+        auto get_elf() const -> const elf::elf& { return m_elf; }
+        auto get_dwarf() const -> const dwarf::dwarf& { return m_dwarf; }
+
+        auto find_line(std::uint64_t pc, std::size_t& hint) const -> const line_row* {
+            return m_line_index.find(pc, hint);
+        }
+
+        auto find_line_entry(std::uint64_t pc, std::size_t& hint) const -> const dwarf::line_table::iterator* {
+            auto row = m_line_index.find(pc, hint);
+            return row ? &row->entry : nullptr;
+        }
+
+        //number of distinct source lines, which per line counters can be sized by
+        auto line_count() const -> std::size_t { return m_locations.size(); }
+        auto get_location(line_id id) const -> const source_location& { return m_locations[id]; }
+
+        auto find_function(std::uint64_t pc, std::size_t& hint) const -> const dwarf::die* {
+            return m_function_index.find(pc, hint);
+        }
+
+        auto lookup_name(const std::string& name) const -> const named_entities* {
+            auto it = m_names.find(name);
+            return it == m_names.end() ? nullptr : &it->second;
+        }
+
+        //all names starting with prefix, in sorted order
+        auto names_with_prefix(const std::string& prefix) const
+            -> std::pair<std::vector<const std::string*>::const_iterator, std::vector<const std::string*>::const_iterator> {
+            auto first = std::lower_bound(m_sorted_names.begin(), m_sorted_names.end(), prefix,
+                                          [](const std::string* name, const std::string& p) { return *name < p; });
+            auto last = first;
+            while (last != m_sorted_names.end() && (*last)->compare(0, prefix.size(), prefix) == 0) {
+                ++last;
+            }
+            return {first, last};
+        }
+
+        //the source cache locks internally, so it's the one piece of the image that can grow
+        auto get_sources() const -> source_cache& { return m_sources; }
+
+        //low_pc of every top level subprogram with code, sorted and without duplicates
+        auto get_function_entries() const -> const std::vector<std::uint64_t>& { return m_function_entries; }
+
+        //first address of every is_stmt row, sorted and without duplicates
+        auto get_statement_addresses() const -> const std::vector<std::uint64_t>& { return m_statement_addresses; }
+
+        //CFI from .eh_frame and .debug_frame, for unwinding code without frame pointers
+        auto get_call_frames() const -> const call_frame_table& { return m_call_frames; }
+
+    private:
+        //libelfin parses line tables, abbrevs and sections lazily, so walking everything here
+        //also makes later concurrent reads safe
+        void build_indexes() {
+            //number the source lines first, so that ids follow file and line order
+            std::map<std::pair<std::string, unsigned>, line_id> ids;
+            for (const auto &cu : m_dwarf.compilation_units()) {
+                for (const auto &row : cu.get_line_table()) {
+                    if (!row.end_sequence) {
+                        ids.emplace(std::make_pair(row.file->path, row.line), 0);
+                    }
+                }
+            }
+            m_locations.reserve(ids.size());
+            for (auto &entry : ids) {
+                entry.second = static_cast<line_id>(m_locations.size());
+                m_locations.push_back(source_location{entry.first.first, entry.first.second});
+            }
+
+            for (const auto &cu : m_dwarf.compilation_units()) {
+                const auto &lt = cu.get_line_table();
+
+                //each row covers the addresses up to the next row, unless it ends its sequence
+                auto prev = lt.end();
+                for (auto it = lt.begin(); it != lt.end(); ++it) {
+                    if (prev != lt.end() && !prev->end_sequence) {
+                        auto id = ids.at(std::make_pair(prev->file->path, prev->line));
+                        m_line_index.add(prev->address, it->address, line_row{prev, id});
+                    }
+                    if (it->is_stmt && !it->end_sequence) {
+                        m_statement_addresses.push_back(it->address);
+                    }
+                    prev = it;
+                }
+
+                for (const auto &die : cu.root()) {
+                    if (die.tag == dwarf::DW_TAG::subprogram) {
+                        if (die.has(dwarf::DW_AT::low_pc)) {
+                            m_function_entries.push_back(at_low_pc(die));
+                            if (die.has(dwarf::DW_AT::name)) {
+                                m_names[at_name(die)].functions.push_back(die);
+                            }
+                        }
+                        //declarations and abstract inline instances have no code, and die_pc_range throws for them
+                        if (die.has(dwarf::DW_AT::low_pc) || die.has(dwarf::DW_AT::ranges)) {
+                            for (const auto &range : die_pc_range(die)) {
+                                m_function_index.add(range.low, range.high, die);
+                            }
+                        }
+                    }
+                }
+            }
+
+            for (auto &sec : m_elf.sections()) {
+                if (sec.get_hdr().type != elf::sht::symtab && sec.get_hdr().type != elf::sht::dynsym)
+                    continue;
+
+                for (auto sym : sec.as_symtab()) {
+                    auto name = sym.get_name();
+                    auto &d = sym.get_data();
+                    m_names[name].symbols.push_back(symbol{to_symbol_type(d.type()), name, d.value});
+                }
+            }
+
+            //map keys don't move, so the sorted view can point straight at them
+            m_sorted_names.reserve(m_names.size());
+            for (const auto &entry : m_names) {
+                if (!entry.first.empty()) {
+                    m_sorted_names.push_back(&entry.first);
+                }
+            }
+            std::sort(m_sorted_names.begin(), m_sorted_names.end(),
+                      [](const std::string* a, const std::string* b) { return *a < *b; });
+
+            m_line_index.sort();
+            m_function_index.sort();
+
+            std::sort(m_function_entries.begin(), m_function_entries.end());
+            m_function_entries.erase(std::unique(m_function_entries.begin(), m_function_entries.end()),
+                                     m_function_entries.end());
+
+            std::sort(m_statement_addresses.begin(), m_statement_addresses.end());
+            m_statement_addresses.erase(std::unique(m_statement_addresses.begin(), m_statement_addresses.end()),
+                                        m_statement_addresses.end());
+        }
+
+        std::string m_path;
+        elf::elf m_elf;
+        dwarf::dwarf m_dwarf;
+        address_table<line_row> m_line_index;
+        std::vector<source_location> m_locations; //by line_id
+        address_table<dwarf::die> m_function_index;
+        std::vector<std::uint64_t> m_statement_addresses;
+        call_frame_table m_call_frames;
+        std::vector<std::uint64_t> m_function_entries;
+        std::unordered_map<std::string, named_entities> m_names;
+        std::vector<const std::string*> m_sorted_names;
+        mutable source_cache m_sources;
+    };
+}
+
+#endif
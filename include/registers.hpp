@@ -2,7 +2,16 @@
 #define MINIDBG_REGISTERS_HPP
 
 #include <sys/user.h>
+#include <sys/ptrace.h>
 #include <algorithm>
+#include <array>
+#include <cstddef>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "stats.hpp"
 
 namespace minidbg {
     enum class reg {
@@ -55,34 +64,138 @@ namespace minidbg {
             { reg::gs, 55, "gs" },
     }};
 
+    //word offset of each register in user_regs_struct, indexed by reg
+    static constexpr std::size_t g_register_offsets[n_registers] = {
+            offsetof(user_regs_struct, rax) / sizeof(uint64_t),
+            offsetof(user_regs_struct, rbx) / sizeof(uint64_t),
+            offsetof(user_regs_struct, rcx) / sizeof(uint64_t),
+            offsetof(user_regs_struct, rdx) / sizeof(uint64_t),
+            offsetof(user_regs_struct, rdi) / sizeof(uint64_t),
+            offsetof(user_regs_struct, rsi) / sizeof(uint64_t),
+            offsetof(user_regs_struct, rbp) / sizeof(uint64_t),
+            offsetof(user_regs_struct, rsp) / sizeof(uint64_t),
+            offsetof(user_regs_struct, r8) / sizeof(uint64_t),
+            offsetof(user_regs_struct, r9) / sizeof(uint64_t),
+            offsetof(user_regs_struct, r10) / sizeof(uint64_t),
+            offsetof(user_regs_struct, r11) / sizeof(uint64_t),
+            offsetof(user_regs_struct, r12) / sizeof(uint64_t),
+            offsetof(user_regs_struct, r13) / sizeof(uint64_t),
+            offsetof(user_regs_struct, r14) / sizeof(uint64_t),
+            offsetof(user_regs_struct, r15) / sizeof(uint64_t),
+            offsetof(user_regs_struct, rip) / sizeof(uint64_t),
+            offsetof(user_regs_struct, eflags) / sizeof(uint64_t),
+            offsetof(user_regs_struct, cs) / sizeof(uint64_t),
+            offsetof(user_regs_struct, orig_rax) / sizeof(uint64_t),
+            offsetof(user_regs_struct, fs_base) / sizeof(uint64_t),
+            offsetof(user_regs_struct, gs_base) / sizeof(uint64_t),
+            offsetof(user_regs_struct, fs) / sizeof(uint64_t),
+            offsetof(user_regs_struct, gs) / sizeof(uint64_t),
+            offsetof(user_regs_struct, ss) / sizeof(uint64_t),
+            offsetof(user_regs_struct, ds) / sizeof(uint64_t),
+            offsetof(user_regs_struct, es) / sizeof(uint64_t),
+    };
+
+    constexpr std::size_t register_offset(reg r) {
+        return g_register_offsets[static_cast<std::size_t>(r)];
+    }
+
+    //DWARF register number to reg, -1 where there's no mapping
+    struct dwarf_register_table {
+        static constexpr std::size_t size = 60;
+        int regs[size];
+    };
+
+    constexpr dwarf_register_table make_dwarf_register_table() {
+        dwarf_register_table t{};
+        for (auto& r : t.regs) r = -1;
+        for (const auto& rd : {
+                std::make_pair(0, reg::rax), std::make_pair(1, reg::rdx), std::make_pair(2, reg::rcx),
+                std::make_pair(3, reg::rbx), std::make_pair(4, reg::rsi), std::make_pair(5, reg::rdi),
+                std::make_pair(6, reg::rbp), std::make_pair(7, reg::rsp), std::make_pair(8, reg::r8),
+                std::make_pair(9, reg::r9), std::make_pair(10, reg::r10), std::make_pair(11, reg::r11),
+                std::make_pair(12, reg::r12), std::make_pair(13, reg::r13), std::make_pair(14, reg::r14),
+                std::make_pair(15, reg::r15), std::make_pair(49, reg::rflags), std::make_pair(50, reg::es),
+                std::make_pair(51, reg::cs), std::make_pair(52, reg::ss), std::make_pair(53, reg::ds),
+                std::make_pair(54, reg::fs), std::make_pair(55, reg::gs), std::make_pair(58, reg::fs_base),
+                std::make_pair(59, reg::gs_base) }) {
+            t.regs[rd.first] = static_cast<int>(rd.second);
+        }
+        return t;
+    }
+
+    static constexpr dwarf_register_table g_dwarf_registers = make_dwarf_register_table();
+
+    reg get_register_from_dwarf_register(unsigned regnum) {
+        if (regnum >= dwarf_register_table::size || g_dwarf_registers.regs[regnum] < 0) {
+            throw std::out_of_range{"Unknown dwarf register"};
+        }
+        return static_cast<reg>(g_dwarf_registers.regs[regnum]);
+    }
+
     uint64_t get_register_value(pid_t pid, reg r) {
         user_regs_struct regs;
+        count_ptrace(PTRACE_GETREGS);
         ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
-        auto it = std::find_if(begin(g_register_descriptors), end(g_register_descriptors),
-                               [r](auto&& rd) { return rd.r == r; });
-
-        return *(reinterpret_cast<uint64_t*>(&regs) + (it - begin(g_register_descriptors)));
+        return *(reinterpret_cast<uint64_t*>(&regs) + register_offset(r));
     }
 
     void set_register_value(pid_t pid, reg r, uint64_t value) {
         user_regs_struct regs;
+        count_ptrace(PTRACE_GETREGS);
         ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
-        auto it = std::find_if(begin(g_register_descriptors), end(g_register_descriptors),
-                               [r](auto&& rd) { return rd.r == r; });
-    
-        *(reinterpret_cast<uint64_t*>(&regs) + (it - begin(g_register_descriptors))) = value;
+        *(reinterpret_cast<uint64_t*>(&regs) + register_offset(r)) = value;
+        count_ptrace(PTRACE_SETREGS);
         ptrace(PTRACE_SETREGS, pid, nullptr, &regs);
     }
 
     uint64_t get_register_value_from_dwarf_register (pid_t pid, unsigned regnum) {
-        auto it = std::find_if(begin(g_register_descriptors), end(g_register_descriptors),
-                               [regnum](auto&& rd) { return rd.dwarf_r == regnum; });
-        if (it == end(g_register_descriptors)) {
-            throw std::out_of_range{"Unknown dwarf register"};
+        return get_register_value(pid, get_register_from_dwarf_register(regnum));
+    }
+
+    //registers of a stopped thread, fetched with one GETREGS per stop. writes are held back
+    //and go out in a single SETREGS when the thread is resumed
+    class register_cache {
+    public:
+        explicit register_cache(pid_t pid) : m_pid{pid} {}
+
+        auto get(reg r) -> uint64_t {
+            return *(reinterpret_cast<uint64_t*>(&get_all()) + register_offset(r));
         }
 
-        return get_register_value(pid, it->r);
-    }
+        auto get_dwarf(unsigned regnum) -> uint64_t {
+            return get(get_register_from_dwarf_register(regnum));
+        }
+
+        void set(reg r, uint64_t value) {
+            *(reinterpret_cast<uint64_t*>(&get_all()) + register_offset(r)) = value;
+            m_dirty = true;
+        }
+
+        auto get_all() -> user_regs_struct& {
+            if (!m_valid) {
+                count_ptrace(PTRACE_GETREGS);
+                ptrace(PTRACE_GETREGS, m_pid, nullptr, &m_regs);
+                m_valid = true;
+            }
+            return m_regs;
+        }
+
+        //call before PTRACE_CONT/SINGLESTEP: writes back any changes and forgets the snapshot
+        void flush() {
+            if (m_dirty) {
+                count_ptrace(PTRACE_SETREGS);
+                ptrace(PTRACE_SETREGS, m_pid, nullptr, &m_regs);
+                m_dirty = false;
+            }
+            m_valid = false;
+        }
+
+    private:
+        pid_t m_pid;
+        user_regs_struct m_regs{};
+        bool m_valid = false;
+        bool m_dirty = false;
+    };
 
     std::string get_register_name(reg r) {
         auto it = std::find_if(begin(g_register_descriptors), end(g_register_descriptors),
@@ -0,0 +1,103 @@
+#ifndef MINIDBG_SOURCE_CACHE_HPP
+#define MINIDBG_SOURCE_CACHE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stats.hpp"
+
+namespace minidbg {
+    struct source_line {
+        const char* data;
+        std::size_t size;
+    };
+
+    //a source file mapped once, with the offset of every line start
+    class source_file {
+    public:
+        explicit source_file(const std::string& path) {
+            auto fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) return;
+
+            struct stat st;
+            if (fstat(fd, &st) == 0) {
+                m_valid = true;
+                if (st.st_size > 0) {
+                    auto data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (data != MAP_FAILED) {
+                        m_data = static_cast<const char*>(data);
+                        m_size = st.st_size;
+                    } else {
+                        m_valid = false;
+                    }
+                }
+            }
+            close(fd);
+
+            //same line numbering as getline: a trailing newline doesn't start another line
+            for (std::size_t i = 0; i < m_size; ++i) {
+                if (i == 0 || m_data[i - 1] == '\n') {
+                    m_line_starts.push_back(i);
+                }
+            }
+            m_line_starts.push_back(m_size);
+        }
+
+        ~source_file() {
+            if (m_data) munmap(const_cast<char*>(m_data), m_size);
+        }
+
+        source_file(const source_file&) = delete;
+        source_file& operator=(const source_file&) = delete;
+
+        bool valid() const { return m_valid; }
+
+        auto size() const -> std::size_t { return m_size; }
+
+        auto line_count() const -> std::size_t { return m_line_starts.empty() ? 0 : m_line_starts.size() - 1; }
+
+        //line is 1-based and must be in [1, line_count()]; the newline is not included
+        auto get_line(unsigned line) const -> source_line {
+            auto begin = m_line_starts[line - 1];
+            auto end = m_line_starts[line];
+            if (end > begin && m_data[end - 1] == '\n') --end;
+            return source_line{m_data + begin, end - begin};
+        }
+
+    private:
+        const char* m_data = nullptr;
+        std::size_t m_size = 0;
+        bool m_valid = false;
+        std::vector<std::size_t> m_line_starts;
+    };
+
+    //loads each source file on first use and keeps it for the life of the cache. safe to share
+    //between threads; files which can't be opened are remembered as invalid
+    class source_cache {
+    public:
+        auto get_file(const std::string& path) -> const source_file& {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            auto& file = m_files[path];
+            if (!file) {
+                hot_timer_scope timing{get_hot_path_stats().source_load};
+                file.reset(new source_file{path});
+                count_hot(get_hot_path_stats().source_bytes, file->size());
+            }
+            return *file;
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::unordered_map<std::string, std::unique_ptr<source_file>> m_files;
+    };
+}
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef MINIDBG_STATS_HPP
+#define MINIDBG_STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <utility>
+
+//the hot path counters below cost a clock read or an atomic add per event. build with
+//-DMINIDBG_NO_HOT_STATS and they compile away, leaving only tracer_stats
+#ifdef MINIDBG_NO_HOT_STATS
+#define MINIDBG_HOT_STATS 0
+#else
+#define MINIDBG_HOT_STATS 1
+#endif
+
+namespace minidbg {
+    //process wide counts of what the tracer asked the kernel for. atomic because the
+    //parallel workers all bump the same counters
+    struct tracer_stats {
+        std::atomic<std::uint64_t> ptrace_calls{0};
+        std::atomic<std::uint64_t> memory_calls{0}; //process_vm_readv and /proc/pid/mem
+        std::atomic<std::uint64_t> waits{0};
+        std::atomic<std::uint64_t> stops{0};        //every trap handed back to the tracer
+        std::atomic<std::uint64_t> attach_stop_us{0};  //from seizing a running process until all its threads stopped
+        std::atomic<std::uint64_t> attach_pause_us{0}; //and until they were all running again
+
+        void write_json(std::ostream& out) const {
+            out << "{\"ptrace_calls\":" << ptrace_calls
+                << ",\"memory_calls\":" << memory_calls
+                << ",\"waits\":" << waits
+                << ",\"stops\":" << stops
+                << ",\"attach_stop_us\":" << attach_stop_us
+                << ",\"attach_pause_us\":" << attach_pause_us << "}\n";
+        }
+    };
+
+    inline tracer_stats& get_tracer_stats() {
+        static tracer_stats stats;
+        return stats;
+    }
+
+    constexpr bool hot_stats_enabled = MINIDBG_HOT_STATS;
+
+    //how often something ran and how long it took, in nanoseconds
+    struct hot_timer {
+        std::atomic<std::uint64_t> calls{0};
+        std::atomic<std::uint64_t> total_ns{0};
+        std::atomic<std::uint64_t> max_ns{0};
+
+        void add(std::uint64_t ns) {
+            calls.fetch_add(1, std::memory_order_relaxed);
+            total_ns.fetch_add(ns, std::memory_order_relaxed);
+            auto max = max_ns.load(std::memory_order_relaxed);
+            while (ns > max && !max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+        }
+    };
+
+    //where the tracer spends its time, for telling which optimizations pay off on a workload
+    struct hot_path_stats {
+        //a slot for each ptrace request the tracer makes, and one for anything else
+        static constexpr std::size_t n_requests = 16;
+
+        std::array<std::atomic<std::uint64_t>, n_requests> ptrace_requests{};
+        hot_timer waitpid;             //blocking waits only
+        hot_timer line_lookup;         //pc to line table row
+        hot_timer function_lookup;     //pc to function
+        hot_timer source_load;         //opening and indexing a source file
+        std::atomic<std::uint64_t> source_bytes{0};
+        std::atomic<std::uint64_t> breakpoint_enables{0};
+        std::atomic<std::uint64_t> breakpoint_disables{0};
+
+        //a switch rather than ranges of request numbers, which are scattered: SINGLEBLOCK is 33 on x86-64
+        static std::size_t request_slot(int request) {
+            switch (request) {
+                case PTRACE_PEEKDATA: return 0;
+                case PTRACE_PEEKUSER: return 1;
+                case PTRACE_POKEDATA: return 2;
+                case PTRACE_POKEUSER: return 3;
+                case PTRACE_CONT: return 4;
+                case PTRACE_SINGLESTEP: return 5;
+                case PTRACE_GETREGS: return 6;
+                case PTRACE_SETREGS: return 7;
+                case PTRACE_DETACH: return 8;
+                case PTRACE_SINGLEBLOCK: return 9;
+                case PTRACE_SETOPTIONS: return 10;
+                case PTRACE_GETEVENTMSG: return 11;
+                case PTRACE_GETSIGINFO: return 12;
+                case PTRACE_SEIZE: return 13;
+                case PTRACE_INTERRUPT: return 14;
+                default: return n_requests - 1;
+            }
+        }
+
+        void write_report(std::ostream& out) const {
+            static const std::pair<int, const char*> names[] = {
+                {PTRACE_PEEKDATA, "PEEKDATA"}, {PTRACE_PEEKUSER, "PEEKUSER"}, {PTRACE_POKEDATA, "POKEDATA"},
+                {PTRACE_POKEUSER, "POKEUSER"}, {PTRACE_CONT, "CONT"}, {PTRACE_SINGLESTEP, "SINGLESTEP"},
+                {PTRACE_GETREGS, "GETREGS"}, {PTRACE_SETREGS, "SETREGS"}, {PTRACE_DETACH, "DETACH"},
+                {PTRACE_SINGLEBLOCK, "SINGLEBLOCK"}, {PTRACE_SETOPTIONS, "SETOPTIONS"},
+                {PTRACE_GETEVENTMSG, "GETEVENTMSG"}, {PTRACE_GETSIGINFO, "GETSIGINFO"},
+                {PTRACE_SEIZE, "SEIZE"}, {PTRACE_INTERRUPT, "INTERRUPT"},
+            };
+
+            const auto& totals = get_tracer_stats();
+            out << "ptrace calls      " << totals.ptrace_calls << '\n';
+            if (!hot_stats_enabled) {
+                out << "(hot path counters were compiled out with MINIDBG_NO_HOT_STATS)\n";
+                return;
+            }
+            for (const auto& name : names) {
+                auto n = ptrace_requests[request_slot(name.first)].load(std::memory_order_relaxed);
+                if (n) out << "  " << std::left << std::setw(16) << name.second << std::right << n << '\n';
+            }
+            if (auto other = ptrace_requests[n_requests - 1].load(std::memory_order_relaxed)) {
+                out << "  " << std::left << std::setw(16) << "other" << std::right << other << '\n';
+            }
+            out << "memory calls      " << totals.memory_calls << '\n'
+                << "stops             " << totals.stops << '\n';
+            write_timer(out, "waitpid", waitpid);
+            write_timer(out, "line lookups", line_lookup);
+            write_timer(out, "function lookups", function_lookup);
+            write_timer(out, "source loads", source_load);
+            out << "source bytes      " << source_bytes << '\n'
+                << "breakpoints       " << breakpoint_enables << " enabled, " << breakpoint_disables << " disabled\n";
+        }
+
+    private:
+        static void write_timer(std::ostream& out, const char* name, const hot_timer& timer) {
+            auto calls = timer.calls.load(std::memory_order_relaxed);
+            auto total = timer.total_ns.load(std::memory_order_relaxed);
+            out << std::left << std::setw(18) << name << std::right << calls << " calls, "
+                << total / 1000 << "us total, " << (calls ? total / calls : 0) << "ns mean, "
+                << timer.max_ns.load(std::memory_order_relaxed) / 1000 << "us max\n";
+        }
+    };
+
+    inline hot_path_stats& get_hot_path_stats() {
+        static hot_path_stats stats;
+        return stats;
+    }
+
+    inline void count_hot(std::atomic<std::uint64_t>& counter, std::uint64_t n = 1) {
+        if (hot_stats_enabled) counter.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    //goes before every ptrace call
+    inline void count_ptrace(int request) {
+        ++get_tracer_stats().ptrace_calls;
+        count_hot(get_hot_path_stats().ptrace_requests[hot_path_stats::request_slot(request)]);
+    }
+
+    //adds the time until the end of the scope to timer
+    class hot_timer_scope {
+    public:
+        explicit hot_timer_scope(hot_timer& timer) : m_timer{timer} {
+            if (hot_stats_enabled) m_start = std::chrono::steady_clock::now();
+        }
+
+        ~hot_timer_scope() {
+            if (!hot_stats_enabled) return;
+            auto elapsed = std::chrono::steady_clock::now() - m_start;
+            m_timer.add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+
+        hot_timer_scope(const hot_timer_scope&) = delete;
+        hot_timer_scope& operator=(const hot_timer_scope&) = delete;
+
+    private:
+        hot_timer& m_timer;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    //a blocking waitpid, counted and timed
+    inline pid_t timed_waitpid(pid_t pid, int* status, int options) {
+        ++get_tracer_stats().waits;
+        hot_timer_scope timing{get_hot_path_stats().waitpid};
+        return waitpid(pid, status, options);
+    }
+}
+
+#endif
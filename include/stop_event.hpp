@@ -0,0 +1,28 @@
+#ifndef MINIDBG_STOP_EVENT_HPP
+#define MINIDBG_STOP_EVENT_HPP
+
+#include <csignal>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+namespace minidbg {
+    //one report from waitpid, decoded from the status word alone. most stops can be dealt with
+    //from this, without a PTRACE_GETSIGINFO round trip
+    struct stop_event {
+        pid_t tid;
+        int status;
+
+        bool exited() const { return WIFEXITED(status) || WIFSIGNALED(status); }
+
+        //the ptrace event in the high bits of the status: PTRACE_EVENT_CLONE and friends, or 0
+        int ptrace_event() const { return WIFSTOPPED(status) ? (status >> 16) & 0xff : 0; }
+
+        int signal() const { return WIFSTOPPED(status) ? WSTOPSIG(status) : 0; }
+
+        //a plain SIGTRAP: a breakpoint, single step or debug register, which siginfo tells apart
+        bool is_trap() const { return signal() == SIGTRAP && ptrace_event() == 0; }
+    };
+}
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef MINIDBG_TERMINAL_WATCH_HPP
+#define MINIDBG_TERMINAL_WATCH_HPP
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+namespace minidbg {
+    //set by the SIGINT handler run() installs, for whichever watcher is running
+    inline std::atomic<bool>& terminal_interrupt_flag() {
+        static std::atomic<bool> flag{false};
+        return flag;
+    }
+
+    inline void on_terminal_interrupt(int) {
+        terminal_interrupt_flag().store(true, std::memory_order_relaxed);
+    }
+
+    //looks after the terminal from a thread of its own while a command runs the debuggee, so the
+    //tracer can go on blocking in waitpid at no cost. when asked to read the terminal, lines typed
+    //meanwhile are queued for the prompt. ^C and "interrupt" call interrupt, told whether it was a
+    //SIGINT, until it returns true to say the debuggee was stopped; "progress", and every few seconds
+    //anyway, call progress with how long the command has been running
+    class terminal_watcher {
+    public:
+        using interrupt_callback = std::function<bool(bool by_signal)>;
+        using progress_callback = std::function<void(std::chrono::steady_clock::duration running)>;
+
+        terminal_watcher(interrupt_callback interrupt, progress_callback progress)
+            : m_interrupt{std::move(interrupt)}, m_progress{std::move(progress)} {
+            if (pipe2(m_wake, O_CLOEXEC) < 0) m_wake[0] = m_wake[1] = -1;
+        }
+
+        ~terminal_watcher() {
+            stop();
+            if (m_wake[0] >= 0) close(m_wake[0]);
+            if (m_wake[1] >= 0) close(m_wake[1]);
+        }
+
+        terminal_watcher(const terminal_watcher&) = delete;
+        terminal_watcher& operator=(const terminal_watcher&) = delete;
+
+        //only between prompts: the terminal is linenoise's while it reads a line. without
+        //read_terminal stdin is left to the debuggee, and only ^C is watched for
+        void start(bool read_terminal) {
+            m_read_terminal = read_terminal;
+            m_done.store(false, std::memory_order_relaxed);
+            m_interrupted.store(false, std::memory_order_relaxed);
+            m_pending = none;
+            terminal_interrupt_flag().store(false, std::memory_order_relaxed);
+            m_started = std::chrono::steady_clock::now();
+            m_thread = std::thread{[this] { watch(); }};
+        }
+
+        void stop() {
+            if (!m_thread.joinable()) return;
+            m_done.store(true, std::memory_order_relaxed);
+            char wake = 0;
+            if (m_wake[1] >= 0 && write(m_wake[1], &wake, 1) < 0) {} //otherwise it notices within a tick
+            m_thread.join();
+            drain_wake();
+        }
+
+        //whether the command just run was interrupted
+        bool interrupted() const { return m_interrupted.load(std::memory_order_relaxed); }
+
+        bool pop(std::string& line) {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            if (m_queued.empty()) return false;
+            line = std::move(m_queued.front());
+            m_queued.pop_front();
+            return true;
+        }
+
+    private:
+        void watch() {
+            //piped input goes to linenoise's stdio buffer, so only a terminal is read from here
+            pollfd fds[2] = {{m_wake[0], POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+            nfds_t n_fds = m_read_terminal && isatty(STDIN_FILENO) ? 2 : 1;
+            const std::chrono::seconds interval{5};
+            auto report = m_started + interval;
+
+            while (!m_done.load(std::memory_order_relaxed)) {
+                fds[1].revents = 0;
+                auto ready = poll(fds, n_fds, tick_ms);
+
+                //a SIGINT (or the debuggee's own signals) can land on this thread, so check every time
+                if (terminal_interrupt_flag().exchange(false, std::memory_order_relaxed)) interrupt(true);
+                if (ready > 0 && (fds[1].revents & POLLIN)) read_lines();
+                if (m_pending != none) interrupt(m_pending == from_signal);
+
+                auto now = std::chrono::steady_clock::now();
+                if (now >= report) {
+                    m_progress(now - m_started);
+                    report += interval;
+                }
+            }
+        }
+
+        //the terminal is in canonical mode while the debuggee runs, so reads come a line at a time
+        void read_lines() {
+            char buffer[256];
+            auto n = read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (n <= 0) return;
+            m_partial.append(buffer, n);
+
+            std::string::size_type newline;
+            while ((newline = m_partial.find('\n')) != std::string::npos) {
+                auto line = m_partial.substr(0, newline);
+                m_partial.erase(0, newline + 1);
+                if (line.empty()) continue;
+
+                if (line == "interrupt") {
+                    interrupt(false);
+                } else if (line == "progress") {
+                    m_progress(std::chrono::steady_clock::now() - m_started);
+                } else {
+                    std::lock_guard<std::mutex> lock{m_mutex};
+                    m_queued.push_back(std::move(line));
+                }
+            }
+        }
+
+        //once per command: any more would be left pending to cut short the next one. until the
+        //callback manages it, it's tried again every tick
+        void interrupt(bool signalled) {
+            if (m_interrupted.load(std::memory_order_relaxed)) return;
+            if (m_pending == none) m_pending = signalled ? from_signal : from_command;
+            if (!m_interrupt(signalled)) return;
+            m_pending = none;
+            m_interrupted.store(true, std::memory_order_relaxed);
+        }
+
+        void drain_wake() {
+            pollfd wake{m_wake[0], POLLIN, 0};
+            char buffer[16];
+            while (m_wake[0] >= 0 && poll(&wake, 1, 0) > 0 && read(m_wake[0], buffer, sizeof(buffer)) > 0) {}
+        }
+
+        static constexpr int tick_ms = 100;
+
+        enum pending_interrupt { none, from_signal, from_command };
+
+        interrupt_callback m_interrupt;
+        progress_callback m_progress;
+        int m_wake[2];                 //written to by stop, so the thread needn't wait out its tick
+        std::chrono::steady_clock::time_point m_started;
+        std::deque<std::string> m_queued;
+        std::mutex m_mutex;
+        std::string m_partial; //the start of a line longer than one read
+        pending_interrupt m_pending = none; //only touched by the thread, and by start before it runs
+        bool m_read_terminal = false;
+        std::atomic<bool> m_done{false};
+        std::atomic<bool> m_interrupted{false};
+        std::thread m_thread;
+    };
+}
+
+#endif
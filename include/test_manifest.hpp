@@ -0,0 +1,156 @@
+#ifndef MINIDBG_TEST_MANIFEST_HPP
+#define MINIDBG_TEST_MANIFEST_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace minidbg {
+    //bytes inside the manifest mapping, not NUL terminated
+    struct text_view {
+        const char* data = nullptr;
+        std::size_t size = 0;
+
+        std::string str() const { return std::string(data, size); }
+        bool empty() const { return size == 0; }
+    };
+
+    //one test, pointing into the manifest it was read from
+    struct test_case {
+        std::vector<text_view> args;  // program path and arguments
+        bool has_stdin = false;
+        text_view stdin_payload;      // fed to the debuggee's stdin
+        bool expected_block = false;  // expected is the whole output, not just its first line
+        text_view expected;
+    };
+
+    //a manifest is a sequence of tests, each of which is
+    //    an argument line         the program and its arguments, separated by spaces
+    //    <<< TAG ... TAG          optional: every line up to one reading TAG is fed to stdin
+    //    an expected line         the answer's first line, or
+    //    >>> TAG ... TAG          the exact output, every line up to one reading TAG
+    //the file is mapped rather than read, and tests are parsed one at a time as they're asked for
+    class test_manifest {
+    public:
+        explicit test_manifest(const std::string& path) {
+            auto fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) return;
+
+            struct stat st;
+            if (fstat(fd, &st) == 0) {
+                m_size = st.st_size;
+                m_valid = true;
+                if (m_size > 0) {
+                    auto data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (data == MAP_FAILED) {
+                        m_valid = false;
+                        m_size = 0;
+                    } else {
+                        m_data = static_cast<const char*>(data);
+                        madvise(data, m_size, MADV_SEQUENTIAL);
+                    }
+                }
+            }
+            close(fd);
+        }
+
+        ~test_manifest() {
+            if (m_data) munmap(const_cast<char*>(m_data), m_size);
+        }
+
+        test_manifest(const test_manifest&) = delete;
+        test_manifest& operator=(const test_manifest&) = delete;
+
+        bool valid() const { return m_valid; }
+
+        //the next test and its position in the manifest; false once they've all been handed out.
+        //workers share one manifest as their queue, so this locks
+        bool next(test_case& test, std::size_t& index) {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            if (m_pos >= m_size) return false;
+
+            test = test_case{};
+            split_args(read_line(), test.args);
+
+            auto line = peek_line();
+            if (starts_with(line, "<<< ")) {
+                read_line();
+                test.has_stdin = true;
+                test.stdin_payload = read_block(tag(line));
+            }
+
+            line = read_line();
+            if (starts_with(line, ">>> ")) {
+                test.expected_block = true;
+                test.expected = read_block(tag(line));
+            } else {
+                test.expected = line;
+            }
+
+            index = m_next_index++;
+            return true;
+        }
+
+    private:
+        auto peek_line() const -> text_view {
+            auto begin = m_data + m_pos;
+            auto end = static_cast<const char*>(std::memchr(begin, '\n', m_size - m_pos));
+            return text_view{begin, static_cast<std::size_t>((end ? end : m_data + m_size) - begin)};
+        }
+
+        auto read_line() -> text_view {
+            if (m_pos >= m_size) return text_view{};
+            auto line = peek_line();
+            m_pos = std::min(m_size, m_pos + line.size + 1);
+            return line;
+        }
+
+        //everything up to the line reading tag, including the last newline before it
+        auto read_block(text_view tag) -> text_view {
+            auto begin = m_data + m_pos;
+            while (m_pos < m_size) {
+                auto line_start = m_pos;
+                auto line = read_line();
+                if (line.size == tag.size && std::memcmp(line.data, tag.data, tag.size) == 0) {
+                    return text_view{begin, static_cast<std::size_t>(m_data + line_start - begin)};
+                }
+            }
+            return text_view{begin, static_cast<std::size_t>(m_data + m_size - begin)};
+        }
+
+        static bool starts_with(text_view line, const char* prefix) {
+            auto n = std::strlen(prefix);
+            return line.size >= n && std::memcmp(line.data, prefix, n) == 0;
+        }
+
+        static auto tag(text_view line) -> text_view {
+            return text_view{line.data + 4, line.size - 4};
+        }
+
+        static void split_args(text_view line, std::vector<text_view>& args) {
+            auto p = line.data, end = line.data + line.size;
+            while (p != end) {
+                while (p != end && *p == ' ') ++p;
+                auto start = p;
+                while (p != end && *p != ' ') ++p;
+                if (p != start) args.push_back(text_view{start, static_cast<std::size_t>(p - start)});
+            }
+        }
+
+        const char* m_data = nullptr;
+        std::size_t m_size = 0;
+        std::size_t m_pos = 0;
+        std::size_t m_next_index = 0;
+        bool m_valid = false;
+        std::mutex m_mutex;
+    };
+}
+
+#endif
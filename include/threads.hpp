@@ -0,0 +1,26 @@
+#ifndef MINIDBG_THREADS_HPP
+#define MINIDBG_THREADS_HPP
+
+#include <sys/ptrace.h>
+#include <sys/types.h>
+
+#include "call_frame.hpp"
+#include "program_image.hpp"
+#include "registers.hpp"
+
+namespace minidbg {
+    //one thread of the debuggee. new ones are reported through PTRACE_O_TRACECLONE
+    struct traced_thread {
+        explicit traced_thread(pid_t tid, bool started = false) : tid{tid}, registers{tid}, started{started} {}
+
+        pid_t tid;
+        register_cache registers;
+        bool started;                      //seen the SIGSTOP a new thread begins with
+        __ptrace_request resume_request = PTRACE_CONT; //how it was last resumed, to restart it after an event stop
+        std::uint64_t block_start = 0;     //pc when last resumed with PTRACE_SINGLEBLOCK
+        line_id last_line = no_line;       //so each thread's repeated lines are folded separately
+        call_stack stack;                  //unwound frames, dropped whenever the thread runs
+    };
+}
+
+#endif
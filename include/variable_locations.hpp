@@ -0,0 +1,271 @@
+#ifndef MINIDBG_VARIABLE_LOCATIONS_HPP
+#define MINIDBG_VARIABLE_LOCATIONS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dwarf/dwarf++.hh"
+#include "elf/elf++.hh"
+
+namespace minidbg {
+    //a DWARF location expression, decoded once into one of the few shapes compilers emit for locals
+    struct variable_location {
+        enum class kind {
+            unavailable,       // optimized out here, or nothing we can evaluate
+            address,           // at the fixed address in offset (DW_OP_addr)
+            frame_offset,      // at the frame base plus offset (DW_OP_fbreg)
+            register_offset,   // at the contents of reg plus offset (DW_OP_breg)
+            in_register,       // the value itself is in reg (DW_OP_reg)
+            call_frame_cfa,    // only as a frame base: the canonical frame address
+            expression,        // an exprloc too complex to compile, evaluated by libelfin each time
+        };
+
+        kind type = kind::unavailable;
+        unsigned reg = 0;            //DWARF register number
+        std::int64_t offset = 0;
+    };
+
+    //one entry of a location list: the location holds while low <= pc < high
+    struct location_range {
+        std::uint64_t low;
+        std::uint64_t high;
+        variable_location location;
+    };
+
+    //lists are a handful of entries long, so a scan beats anything cleverer
+    inline auto find_location(const std::vector<location_range>& ranges, std::uint64_t pc) -> const variable_location* {
+        for (const auto& range : ranges) {
+            if (range.low <= pc && pc < range.high) return &range.location;
+        }
+        return nullptr;
+    }
+
+    struct local_variable {
+        std::string name;
+        std::size_t size;
+        bool is_signed;                      //narrower values need sign extending
+        dwarf::die die;                      //for expression locations
+        std::vector<location_range> ranges;  //empty if the variable is nowhere
+    };
+
+    //a function's parameters and locals, in scope order, including those of nested blocks
+    struct function_variables {
+        std::vector<location_range> frame_base;
+        std::vector<local_variable> variables;
+    };
+
+    //where a variable is at one particular stop
+    struct variable_place {
+        enum class kind { nowhere, memory, reg };
+        kind type = kind::nowhere;
+        std::uint64_t value = 0; //address, or DWARF register number
+    };
+
+    //byte size of a variable's type, looking through typedefs and qualifiers
+    inline std::size_t variable_size(const dwarf::die& var) {
+        auto type = var;
+        while (type.has(dwarf::DW_AT::type)) {
+            type = type[dwarf::DW_AT::type].as_reference();
+            if (type.has(dwarf::DW_AT::byte_size)) {
+                return type[dwarf::DW_AT::byte_size].as_uconstant();
+            }
+        }
+        return sizeof(std::uint64_t);
+    }
+
+    //whether a variable's type is a signed integer, looking through typedefs and qualifiers
+    inline bool variable_is_signed(const dwarf::die& var) {
+        auto type = var;
+        while (type.has(dwarf::DW_AT::type)) {
+            type = type[dwarf::DW_AT::type].as_reference();
+            if (type.tag == dwarf::DW_TAG::pointer_type) return false;
+            if (type.has(dwarf::DW_AT::encoding)) {
+                auto encoding = type[dwarf::DW_AT::encoding].as_uconstant();
+                return encoding == 0x05 || encoding == 0x06; //DW_ATE_signed, DW_ATE_signed_char
+            }
+        }
+        return false;
+    }
+
+    inline std::uint64_t read_uleb128(const std::uint8_t*& p, const std::uint8_t* end) {
+        std::uint64_t result = 0;
+        unsigned shift = 0;
+        while (p < end) {
+            auto byte = *p++;
+            if (shift < 64) result |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            shift += 7;
+            if (!(byte & 0x80)) break;
+        }
+        return result;
+    }
+
+    inline std::int64_t read_sleb128(const std::uint8_t*& p, const std::uint8_t* end) {
+        std::int64_t result = 0;
+        unsigned shift = 0;
+        std::uint8_t byte = 0;
+        while (p < end) {
+            byte = *p++;
+            if (shift < 64) result |= static_cast<std::int64_t>(byte & 0x7f) << shift;
+            shift += 7;
+            if (!(byte & 0x80)) break;
+        }
+        if (shift < 64 && (byte & 0x40)) result |= -(static_cast<std::int64_t>(1) << shift);
+        return result;
+    }
+
+    //single operation expressions only; anything else is left unavailable
+    inline variable_location compile_location(const std::uint8_t* ops, std::size_t len) {
+        using kind = variable_location::kind;
+        variable_location location{};
+        if (len == 0) return location;
+
+        auto p = ops + 1, end = ops + len;
+        auto op = ops[0];
+        if (op == 0x03 && len == 1 + sizeof(std::uint64_t)) {           //DW_OP_addr
+            std::uint64_t address;
+            std::memcpy(&address, p, sizeof(address));
+            p += sizeof(address);
+            location.type = kind::address;
+            location.offset = static_cast<std::int64_t>(address);
+        } else if (op >= 0x50 && op <= 0x6f) {                          //DW_OP_reg0-31
+            location.type = kind::in_register;
+            location.reg = op - 0x50;
+        } else if (op >= 0x70 && op <= 0x8f) {                          //DW_OP_breg0-31
+            location.type = kind::register_offset;
+            location.reg = op - 0x70;
+            location.offset = read_sleb128(p, end);
+        } else if (op == 0x90) {                                        //DW_OP_regx
+            location.type = kind::in_register;
+            location.reg = read_uleb128(p, end);
+        } else if (op == 0x91) {                                        //DW_OP_fbreg
+            location.type = kind::frame_offset;
+            location.offset = read_sleb128(p, end);
+        } else if (op == 0x92) {                                        //DW_OP_bregx
+            location.type = kind::register_offset;
+            location.reg = read_uleb128(p, end);
+            location.offset = read_sleb128(p, end);
+        } else if (op == 0x9c) {                                        //DW_OP_call_frame_cfa
+            location.type = kind::call_frame_cfa;
+        }
+
+        if (p != end) return variable_location{};
+        return location;
+    }
+
+    using pc_ranges = std::vector<std::pair<std::uint64_t, std::uint64_t>>;
+
+    //DWARF 4 .debug_loc: (begin, end) address pairs relative to the unit's base address, each
+    //followed by a 2 byte length and the expression; (0, 0) ends the list and (~0, addr) moves the base
+    inline void read_location_list(const elf::elf& elf, std::uint64_t offset, std::uint64_t base,
+                                   std::vector<location_range>& ranges) {
+        const auto& section = elf.get_section(".debug_loc");
+        if (!section.valid()) return;
+
+        auto data = static_cast<const std::uint8_t*>(section.data());
+        auto size = section.size();
+        while (offset + 2 * sizeof(std::uint64_t) <= size) {
+            std::uint64_t begin, end;
+            std::memcpy(&begin, data + offset, sizeof(begin));
+            std::memcpy(&end, data + offset + sizeof(begin), sizeof(end));
+            offset += 2 * sizeof(std::uint64_t);
+
+            if (begin == 0 && end == 0) return;
+            if (begin == std::numeric_limits<std::uint64_t>::max()) {
+                base = end;
+                continue;
+            }
+
+            if (offset + 2 > size) return;
+            std::uint16_t len;
+            std::memcpy(&len, data + offset, sizeof(len));
+            offset += sizeof(len);
+            if (offset + len > size) return;
+
+            auto location = compile_location(data + offset, len);
+            offset += len;
+            if (begin != end && location.type != variable_location::kind::unavailable) {
+                ranges.push_back(location_range{base + begin, base + end, location});
+            }
+        }
+    }
+
+    //the ranges of a location attribute, clipped to the pcs the variable is in scope for
+    inline std::vector<location_range> compile_location_attribute(const dwarf::die& die, dwarf::DW_AT attr,
+                                                                   const elf::elf& elf, const pc_ranges& scope) {
+        using namespace dwarf;
+        std::vector<location_range> ranges;
+        if (!die.has(attr)) return ranges;
+
+        auto value = die[attr];
+        if (value.get_type() == dwarf::value::type::exprloc) {
+            std::size_t len = 0;
+            auto ops = static_cast<const std::uint8_t*>(value.as_block(&len));
+            auto location = compile_location(ops, len);
+            if (location.type == variable_location::kind::unavailable) {
+                location.type = variable_location::kind::expression;
+            }
+            for (const auto& range : scope) {
+                ranges.push_back(location_range{range.first, range.second, location});
+            }
+            return ranges;
+        }
+
+        if (value.get_type() == dwarf::value::type::loclist) {
+            const auto& unit_root = die.get_unit().root();
+            auto base = unit_root.has(DW_AT::low_pc) ? at_low_pc(unit_root) : 0;
+            std::vector<location_range> listed;
+            read_location_list(elf, value.as_sec_offset(), base, listed);
+
+            for (const auto& entry : listed) {
+                for (const auto& range : scope) {
+                    auto low = std::max(entry.low, range.first), high = std::min(entry.high, range.second);
+                    if (low < high) ranges.push_back(location_range{low, high, entry.location});
+                }
+            }
+        }
+        return ranges;
+    }
+
+    inline void collect_variables(const dwarf::die& parent, const elf::elf& elf, const pc_ranges& scope,
+                                  std::vector<local_variable>& variables) {
+        using namespace dwarf;
+        for (const auto& die : parent) {
+            if (die.tag == DW_TAG::variable || die.tag == DW_TAG::formal_parameter) {
+                if (!die.has(DW_AT::name)) continue;
+                variables.push_back(local_variable{at_name(die), variable_size(die), variable_is_signed(die), die,
+                                                   compile_location_attribute(die, DW_AT::location, elf, scope)});
+            } else if (die.tag == DW_TAG::lexical_block) {
+                if (!die.has(DW_AT::low_pc) && !die.has(DW_AT::ranges)) {
+                    collect_variables(die, elf, scope, variables);
+                    continue;
+                }
+
+                pc_ranges inner;
+                for (const auto& block : die_pc_range(die)) {
+                    for (const auto& range : scope) {
+                        auto low = std::max(block.low, range.first), high = std::min(block.high, range.second);
+                        if (low < high) inner.emplace_back(low, high);
+                    }
+                }
+                collect_variables(die, elf, inner, variables);
+            }
+        }
+    }
+
+    inline function_variables compile_function_variables(const dwarf::die& func, const elf::elf& elf) {
+        function_variables frame{};
+        pc_ranges everywhere{{0, std::numeric_limits<std::uint64_t>::max()}};
+
+        frame.frame_base = compile_location_attribute(func, dwarf::DW_AT::frame_base, elf, everywhere);
+        collect_variables(func, elf, everywhere, frame.variables);
+        return frame;
+    }
+}
+
+#endif
@@ -1,136 +1,100 @@
 #include "debugger.hpp"
 #include "registers.hpp"
 #include "breakpoint.hpp"
+#include "line_set.hpp"
+#include "fault_localization.hpp"
+#include "test_manifest.hpp"
+#include "fork_server.hpp"
+#include "coverage_cache.hpp"
+#include "terminal_watch.hpp"
 
 #include "linenoise.h"
 
 #include <sys/ptrace.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <iomanip>
 #include <string>
 #include <map>
+#include <cstring>
+#include <cerrno>
 #include <error.h>
-#include <set>
+#include <thread>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <climits>
 
 using namespace minidbg;
 
-static int last = 0;
-static std::set<int> success_set;
-static std::set<int> fail_set;
-
-
-symbol_type to_symbol_type(elf::stt sym) {
-    switch (sym) {
-        case elf::stt::notype:
-            return symbol_type::notype;
-        case elf::stt::object:
-            return symbol_type::object;
-        case elf::stt::func:
-            return symbol_type::func;
-        case elf::stt::section:
-            return symbol_type::section;
-        case elf::stt::file:
-            return symbol_type::file;
-        default:
-            return symbol_type::notype;
-    }
-};
+//software breakpoints hit this often move to a free debug register
+static constexpr unsigned hot_breakpoint_hits = 16;
+//deeper than this the stack is taken to be garbage
+static constexpr std::size_t max_call_depth = 4096;
+//EFLAGS.RF: suppresses instruction breakpoints for the next instruction
+static constexpr uint64_t resume_flag = 1 << 16;
+//sent by the profiler's timer and to wake the tracer for a detach; told apart from the debuggee's
+//own by its sender. ignored by default, so one still pending when we detach does no harm
+static constexpr int sample_signal = SIGURG;
 
-std::vector<symbol> debugger::lookup_symbol(const std::string &name) {
-    std::vector<symbol> syms;
 
-    for (auto &sec : m_elf.sections()) {
-        if (sec.get_hdr().type != elf::sht::symtab && sec.get_hdr().type != elf::sht::dynsym)
-            continue;
 
-        for (auto sym : sec.as_symtab()) {
-            if (sym.get_name() == name) {
-                auto &d = sym.get_data();
-                syms.push_back(symbol{to_symbol_type(d.type()), sym.get_name(), d.value});
-            }
-        }
+std::vector<symbol> debugger::lookup_symbol(const std::string &name) {
+    if (auto entry = m_image->lookup_name(name)) {
+        return entry->symbols;
     }
-
-    return syms;
+    return {};
 }
 
 uint64_t debugger::get_pc() {
-    return get_register_value(m_pid, reg::rip);
+    return m_thread->registers.get(reg::rip);
 }
 
 void debugger::set_pc(uint64_t pc) {
-    set_register_value(m_pid, reg::rip, pc);
+    m_thread->registers.set(reg::rip, pc);
+    m_thread->stack = call_stack{};
 }
 
 dwarf::die debugger::get_function_from_pc(uint64_t pc) {
-    for (auto &cu : m_dwarf.compilation_units()) {
-        if (die_pc_range(cu.root()).contains(pc)) {
-            for (const auto &die : cu.root()) {
-                if (die.tag == dwarf::DW_TAG::subprogram) {
-                    if (die_pc_range(die).contains(pc)) {
-                        return die;
-                    }
-                }
-            }
-        }
+    hot_timer_scope timing{get_hot_path_stats().function_lookup};
+    if (auto func = m_image->find_function(pc - m_load_bias, m_function_hint)) {
+        return *func;
     }
 
     throw std::out_of_range{"Cannot find function"};
 }
 
 dwarf::line_table::iterator debugger::get_line_entry_from_pc(uint64_t pc) {
-    for (auto &cu : m_dwarf.compilation_units()) {
-        if (die_pc_range(cu.root()).contains(pc)) {
-            auto &lt = cu.get_line_table();
-            auto it = lt.find_address(pc);
-            if (it == lt.end()) {
-                throw std::out_of_range{"Cannot find line entry"};
-            } else {
-                return it;
-            }
-        }
-    }
-
-    throw std::out_of_range{"Cannot find line entry"};
+    return get_line_from_pc(pc).entry;
 }
 
-void debugger::run() {
-    int wait_status;
-    auto options = 0;
-    waitpid(m_pid, &wait_status, options);
-
-    char *line = nullptr;
-    while ((line = linenoise("minidbg> ")) != nullptr) {
-        handle_command(line);
-        linenoiseHistoryAdd(line);
-        linenoiseFree(line);
+const line_row &debugger::get_line_from_pc(uint64_t pc) {
+    hot_timer_scope timing{get_hot_path_stats().line_lookup};
+    if (auto row = m_image->find_line(pc - m_load_bias, m_line_hint)) {
+        return *row;
     }
+
+    throw std::out_of_range{"Cannot find line entry"};
 }
 
 void debugger::print_source(const std::string &file_name, unsigned line, unsigned n_lines_context) {
-    std::ifstream file{file_name};
+    const auto &file = m_image->get_sources().get_file(file_name);
     auto start_line = line <= n_lines_context ? 1 : line - n_lines_context;
     auto end_line = line + n_lines_context + (line < n_lines_context ? n_lines_context - line : 0) + 1;
+    end_line = std::min<unsigned>(end_line, file.line_count());
 
-    char c{};
-    auto current_line = 1u;
-    while (current_line != start_line && file.get(c)) {
-        if (c == '\n') {
-            ++current_line;
-        }
+    for (auto current_line = start_line; current_line <= end_line; ++current_line) {
+        auto text = file.get_line(current_line);
+        std::cout << (current_line == line ? "> " : "  ");
+        std::cout.write(text.data, text.size) << '\n';
     }
-    std::cout << (current_line == line ? "> " : "  ");
-    while (current_line <= end_line && file.get(c)) {
-        std::cout << c;
-        if (c == '\n') {
-            ++current_line;
-            std::cout << (current_line == line ? "> " : "  ");
-        }
-    }
-    std::cout << std::endl;
+    std::cout << (end_line + 1 == line ? "> " : "  ") << std::endl;
 }
 
 bool is_prefix(const std::string &s, const std::string &of) {
@@ -144,9 +108,105 @@ bool is_suffix(const std::string &s, const std::string &of) {
     return std::equal(s.begin(), s.end(), of.begin() + diff);
 }
 
+//image consulted by the linenoise completion callback, which can't carry any state of its own
+static const program_image *completion_image = nullptr;
+
+//tab completes symbol and function names for the commands which take them
+void complete_command(const char *buf, linenoiseCompletions *completions) {
+    if (!completion_image) return;
+
+    std::string line{buf};
+    auto space = line.find(' ');
+    if (space == std::string::npos) return;
+
+    auto command = line.substr(0, space);
+    if (!is_prefix(command, "break") && !is_prefix(command, "symbol")) return;
+
+    auto word_start = line.find_last_of(' ') + 1;
+    auto prefix = line.substr(word_start);
+    if (prefix.empty()) return;
+
+    const std::size_t max_completions = 64;
+    auto names = completion_image->names_with_prefix(prefix);
+    for (auto it = names.first; it != names.second && completions->len < max_completions; ++it) {
+        linenoiseAddCompletion(completions, (line.substr(0, word_start) + **it).c_str());
+    }
+}
+
+//counts since the session started, from the terminal watcher's thread
+static void print_progress(std::chrono::steady_clock::duration running) {
+    auto &stats = get_tracer_stats();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(running).count();
+    std::cerr << "[running " << ms / 1000 << '.' << ms / 100 % 10 << "s: " << stats.stops << " stops, "
+              << stats.ptrace_calls << " ptrace calls]" << std::endl;
+}
+
+//a command runs the debuggee with the tracer blocked in waitpid as usual, while a watcher thread
+//keeps the terminal: lines typed meanwhile queue up for after it, unless the debuggee shares the
+//terminal, and ^C or "interrupt" stop the debuggee with the same wake signal request_detach sends,
+//which the waits already swallow
+void debugger::run() {
+    wait_for_start();
+
+    completion_image = m_image.get();
+    linenoiseSetCompletionCallback(complete_command);
+
+    //SA_RESTART, so the tracer's waitpid carries on. the handler only sets the watcher's flag
+    struct sigaction on_interrupt{};
+    on_interrupt.sa_handler = on_terminal_interrupt;
+    on_interrupt.sa_flags = SA_RESTART;
+    sigemptyset(&on_interrupt.sa_mask);
+    sigaction(SIGINT, &on_interrupt, nullptr);
+
+    auto pid = m_pid;
+    auto &waiting = m_waiting;
+    terminal_watcher watcher{
+        [pid, &waiting](bool by_signal) {
+            //in the terminal's foreground group the debuggee got the SIGINT too, and stops for that
+            if (by_signal && getpgid(pid) == tcgetpgrp(STDIN_FILENO)) return true;
+            //a command which hasn't resumed the debuggee would leave the wake pending for the next one
+            if (!waiting.load(std::memory_order_relaxed)) return false;
+            kill(pid, sample_signal);
+            return true;
+        },
+        print_progress};
+
+    std::string command;
+    while (!m_exited) {
+        if (watcher.pop(command)) {
+            std::cout << "minidbg> " << command << std::endl;
+        } else {
+            auto line = linenoise("minidbg> ");
+            if (!line) {
+                if (errno == EAGAIN) continue; //^C at the prompt only clears the line
+                break;
+            }
+            command = line;
+            linenoiseHistoryAdd(line);
+            linenoiseFree(line);
+        }
+
+        //a debuggee in the terminal's foreground group reads it too, so only ^C is ours then
+        watcher.start(getpgid(pid) != tcgetpgrp(STDIN_FILENO));
+        handle_command(command);
+        watcher.stop();
+
+        if (m_exited) {
+            std::cout << "Process exited" << std::endl;
+        } else if (watcher.interrupted()) {
+            std::cout << "Interrupted at 0x" << std::hex << get_pc() << std::dec << std::endl;
+            if (has_line_info(get_pc())) {
+                auto line_entry = get_line_entry_from_pc(get_pc());
+                print_source(line_entry->file->path, line_entry->line);
+            }
+        }
+    }
+}
+
 siginfo_t debugger::get_signal_info() {
     siginfo_t info;
-    ptrace(PTRACE_GETSIGINFO, m_pid, nullptr, &info);
+    count_ptrace(PTRACE_GETSIGINFO);
+    ptrace(PTRACE_GETSIGINFO, m_thread->tid, nullptr, &info);
     return info;
 }
 
@@ -157,99 +217,702 @@ void debugger::handle_sigtrap(siginfo_t info) {
         case TRAP_BRKPT: {
             set_pc(get_pc() - 1);
             //std::cout << "Hit breakpoint at address 0x" << std::hex << get_pc() << std::endl;
-            auto line_entry = get_line_entry_from_pc(get_pc());
-
-
-            print_source_advice(line_entry->file->path, line_entry->line);
+            handle_breakpoint_hit();
             return;
         }
-            //this will be set if the signal was sent by single stepping
+            //a debug register fired: either a watchpoint or a hardware breakpoint, which
+            //stops before the instruction so the pc needs no adjusting
+        case TRAP_HWBKPT: {
+            auto slot = m_debug_registers.take_hit(m_thread->tid);
+            if (slot < 0) return;
+            if (m_watchpoints.count(slot)) {
+                report_watchpoint(slot);
+            } else {
+                handle_breakpoint_hit();
+            }
+            return;
+        }
+            //this will be set if the signal was sent by single stepping, or by block stepping
         case TRAP_TRACE:
+        case TRAP_BRANCH:
             return;
         default:
-            std::cout << "Unknown SIGTRAP code " << info.si_code << std::endl;
+            m_out << "Unknown SIGTRAP code " << info.si_code << std::endl;
+            return;
+    }
+}
+
+void debugger::handle_breakpoint_hit() {
+    auto bp = m_breakpoints.find(get_pc());
+
+    //filters come before any reporting, so a hit that doesn't stop costs the condition and no more.
+    //it still counts towards moving the breakpoint into a debug register. where a next or finish
+    //is headed always stops
+    if (bp != m_breakpoints.end() && !m_breakpoint_filters.empty() && !m_step_targets.count(bp->first)) {
+        auto filter = m_breakpoint_filters.find(bp->first);
+        if (filter != m_breakpoint_filters.end() && !filter_passes(filter->second)) {
+            if (bp->second.record_hit() == hot_breakpoint_hits) {
+                bp->second.make_hardware();
+            }
+            m_skip_stop = true;
             return;
+        }
+    }
+
+    print_source_advice(get_line_from_pc(get_pc()));
+    if (bp == m_breakpoints.end()) return;
+
+    //in first hit coverage we only care that the line ran, so stop trapping on it
+    if (m_first_hit_only) {
+        remove_breakpoint(get_pc());
+    } else if (bp->second.record_hit() == hot_breakpoint_hits) {
+        bp->second.make_hardware();
+    }
+}
+
+bool debugger::filter_passes(breakpoint_filter &filter) {
+    if (filter.has_condition && !condition_holds(filter.condition)) return false;
+    if (filter.ignore_count > 0) {
+        --filter.ignore_count;
+        return false;
+    }
+    return true;
+}
+
+//every operand in memory is fetched with one read, the rest come from the cached registers.
+//a variable that's optimized out at this pc makes the condition false
+bool debugger::condition_holds(const breakpoint_condition &cond) {
+    constexpr auto max_operands = breakpoint_condition::max_operands;
+    std::uint64_t raw[max_operands] = {};
+    std::int64_t values[max_operands];
+    iovec local[max_operands], remote[max_operands];
+    std::size_t reads = 0;
+
+    for (std::size_t i = 0; i < cond.operands.size(); ++i) {
+        const auto &operand = cond.operands[i];
+        auto address = operand.address;
+        if (operand.local) {
+            auto place = locate_variable(*cond.frame, *operand.local);
+            if (place.type == variable_place::kind::nowhere) return false;
+            if (place.type == variable_place::kind::reg) {
+                raw[i] = m_thread->registers.get_dwarf(place.value);
+                continue;
+            }
+            address = place.value;
+        }
+        auto len = std::min(operand.size, sizeof(raw[i]));
+        local[reads] = iovec{&raw[i], len};
+        remote[reads] = iovec{reinterpret_cast<void *>(address), len};
+        ++reads;
+    }
+    if (!m_memory.read_scattered(local, remote, reads)) return false;
+
+    for (std::size_t i = 0; i < cond.operands.size(); ++i) {
+        values[i] = extend_operand(raw[i], cond.operands[i]);
+    }
+    return evaluate_condition(cond, values);
+}
+
+//names resolve to the locals in scope at addr, innermost first, then to globals
+bool debugger::compile_condition(std::intptr_t addr, const std::string &text, breakpoint_condition &cond,
+                                 std::string &error) {
+    using namespace dwarf;
+    const function_variables *frame = nullptr;
+    try {
+        frame = &get_function_variables(get_function_from_pc(addr));
+    } catch (std::out_of_range &) {}
+    cond.frame = frame;
+    auto pc = addr - m_load_bias;
+
+    auto resolve = [&](const std::string &name, condition_operand &operand) {
+        if (frame) {
+            const local_variable *found = nullptr;
+            for (auto var = frame->variables.rbegin(); var != frame->variables.rend(); ++var) {
+                if (var->name != name || var->ranges.empty()) continue;
+                if (!found) found = &*var;
+                if (find_location(var->ranges, pc)) {
+                    found = &*var;
+                    break;
+                }
+            }
+            if (found) {
+                operand = condition_operand{found, 0, found->size, found->is_signed};
+                return true;
+            }
+        }
+
+        pc_ranges everywhere{{0, std::numeric_limits<std::uint64_t>::max()}};
+        for (const auto &cu : m_image->get_dwarf().compilation_units()) {
+            for (const auto &die : cu.root()) {
+                if (die.tag != DW_TAG::variable || !die.has(DW_AT::name) || at_name(die) != name) continue;
+                auto ranges = compile_location_attribute(die, DW_AT::location, m_image->get_elf(), everywhere);
+                if (ranges.empty() || ranges.front().location.type != variable_location::kind::address) continue;
+                operand = condition_operand{nullptr, ranges.front().location.offset + m_load_bias,
+                                            variable_size(die), variable_is_signed(die)};
+                return true;
+            }
+        }
+        return false;
+    };
+    return condition_compiler{text, resolve}.compile(cond, error);
+}
+
+void debugger::set_breakpoint_filter(const std::vector<std::intptr_t> &addrs, unsigned ignore_count,
+                                     const std::string &condition) {
+    for (auto addr : addrs) {
+        breakpoint_filter filter{};
+        filter.ignore_count = ignore_count;
+        if (!condition.empty()) {
+            std::string error;
+            if (!compile_condition(addr, condition, filter.condition, error)) {
+                //a breakpoint that stopped regardless of its condition would be worse than none
+                std::cerr << "Bad condition: " << error << "\n";
+                remove_breakpoint(addr);
+                continue;
+            }
+            filter.has_condition = true;
+        }
+        m_breakpoint_filters[addr] = std::move(filter);
+    }
+}
+
+void debugger::report_watchpoint(int slot) {
+    auto &wp = m_watchpoints[slot];
+    uint64_t value = 0;
+    read_memory(wp.address, wp.len, &value);
+
+    m_out << "Watchpoint " << slot << ": " << wp.name << " changed from " << std::dec << wp.value
+          << " to " << value << std::endl;
+    wp.value = value;
+
+    try {
+        auto line_entry = get_line_entry_from_pc(get_pc());
+        print_source(line_entry->file->path, line_entry->line);
+    } catch (std::out_of_range &) {
+        m_out << "at 0x" << std::hex << get_pc() << std::endl;
+    }
+}
+
+//the exec stop. from here on clones are traced too, so new threads are ours from their first instruction.
+//the program is mapped by then, so this is also where we find out where it went
+void debugger::wait_for_start() {
+    if (!m_started_at_main && !m_attached) {
+        int wait_status;
+        auto options = 0;
+        timed_waitpid(m_pid, &wait_status, options);
+
+        count_ptrace(PTRACE_SETOPTIONS);
+        ptrace(PTRACE_SETOPTIONS, m_pid, nullptr, PTRACE_O_TRACECLONE);
+    }
+    m_load_bias = find_load_bias(m_pid, m_image->get_elf());
+}
+
+void debugger::add_thread(pid_t tid) {
+    if (m_threads.count(tid)) return;
+    m_threads.emplace(tid, traced_thread{tid});
+    m_debug_registers.add_thread(tid);
+}
+
+void debugger::remove_thread(pid_t tid) {
+    //the main thread's exit is only reported once the whole process has gone, and it stays the fallback
+    if (tid == m_pid) return;
+    if (m_thread->tid == tid) {
+        m_thread = &m_threads.at(m_pid);
+    }
+    m_debug_registers.remove_thread(tid);
+    m_threads.erase(tid);
+}
+
+//false if the kernel refused, as it does PTRACE_SINGLEBLOCK where the hardware can't
+bool debugger::resume(traced_thread &thread, __ptrace_request request) {
+    if (m_holding_threads) release_threads(thread.tid);
+    if (request == PTRACE_SINGLEBLOCK) thread.block_start = thread.registers.get(reg::rip);
+    thread.registers.flush();
+    thread.stack = call_stack{};
+    thread.resume_request = request;
+    count_ptrace(request);
+    return ptrace(request, thread.tid, nullptr, nullptr) == 0;
+}
+
+//clone reports and the SIGSTOP each new thread starts with are bookkeeping: deal with them here
+//and restart the thread. returns false for stops the caller has to see
+bool debugger::handle_thread_event(const stop_event &event) {
+    if (event.ptrace_event() == PTRACE_EVENT_CLONE) {
+        unsigned long new_tid = 0;
+        count_ptrace(PTRACE_GETEVENTMSG);
+        ptrace(PTRACE_GETEVENTMSG, event.tid, nullptr, &new_tid);
+        add_thread(new_tid);
+
+        auto &thread = m_threads.at(event.tid);
+        resume(thread, thread.resume_request);
+        return true;
+    }
+
+    //the new thread's first stop can be reported before its parent's clone event
+    add_thread(event.tid);
+    auto &thread = m_threads.at(event.tid);
+    if (!thread.started && (event.signal() == SIGSTOP || event.ptrace_event() == PTRACE_EVENT_STOP)) {
+        thread.started = true;
+        resume(thread, m_new_thread_request);
+        return true;
+    }
+
+    //a seized process's group stops, and the interrupt from attaching to a thread which stopped
+    //for something else first. job control doesn't get a say while we trace
+    if (event.ptrace_event() == PTRACE_EVENT_STOP) {
+        resume(thread, thread.resume_request);
+        return true;
+    }
+    return false;
+}
+
+//the threads of pid, as /proc lists them
+static std::vector<pid_t> list_threads(pid_t pid) {
+    std::vector<pid_t> tids;
+    auto dir = opendir(("/proc/" + std::to_string(pid) + "/task").c_str());
+    if (!dir) return tids;
+    while (auto entry = readdir(dir)) {
+        if (entry->d_name[0] != '.') tids.push_back(std::atoi(entry->d_name));
+    }
+    closedir(dir);
+    return tids;
+}
+
+//seizes and interrupts every thread, then waits for them all to stop. threads started in the
+//meantime are picked up through their parent's clone event, or on another pass over /proc
+bool debugger::attach(std::chrono::microseconds timeout) {
+    using namespace std::chrono;
+    m_attached = true;
+    m_attach_started = steady_clock::now();
+
+    std::unordered_set<pid_t> seen, pending;
+    for (auto found = true; found;) {
+        found = false;
+        for (auto tid : list_threads(m_pid)) {
+            if (!seen.insert(tid).second) continue;
+            found = true;
+
+            count_ptrace(PTRACE_SEIZE);
+            if (ptrace(PTRACE_SEIZE, tid, nullptr, PTRACE_O_TRACECLONE) < 0 && tid == m_pid) {
+                std::cerr << "Error attaching to " << m_pid << ": " << strerror(errno) << "\n";
+                m_exited = true;
+                return false;
+            }
+            //one we couldn't seize may be ours already, through a clone event, or gone
+            count_ptrace(PTRACE_INTERRUPT);
+            if (ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr) == 0) {
+                add_thread(tid);
+                pending.insert(tid);
+            }
+        }
+    }
+
+    auto stopped = wait_for_threads(pending, m_attach_started + timeout);
+    get_tracer_stats().attach_stop_us = duration_cast<microseconds>(steady_clock::now() - m_attach_started).count();
+    if (!stopped) {
+        if (m_exited) return false;
+        //threads still running can't be detached from: they're let go when we exit
+        std::cerr << pending.size() << " threads of " << m_pid << " didn't stop within "
+                  << duration_cast<milliseconds>(timeout).count() << "ms\n";
+        for (auto &entry : m_threads) {
+            if (pending.count(entry.first)) continue;
+            count_ptrace(PTRACE_DETACH);
+            ptrace(PTRACE_DETACH, entry.first, nullptr, nullptr);
+        }
+        m_exited = true;
+        return false;
+    }
+
+    for (auto &entry : m_threads) {
+        entry.second.started = true;
+    }
+    m_thread = &m_threads.at(m_pid);
+    m_holding_threads = true;
+    return true;
+}
+
+//attaching leaves every thread stopped while breakpoints go in. they all start again with the
+//first one the debugger resumes, which ends the pause the process sees
+void debugger::release_threads(pid_t except) {
+    using namespace std::chrono;
+    m_holding_threads = false;
+    for (auto &entry : m_threads) {
+        if (entry.first != except) resume(entry.second, m_new_thread_request);
+    }
+    get_tracer_stats().attach_pause_us = duration_cast<microseconds>(steady_clock::now() - m_attach_started).count();
+}
+
+//waits until every thread in pending has stopped, or the deadline has passed, taking in threads
+//created meanwhile. a thread stopped just past a software breakpoint is put back on it
+bool debugger::wait_for_threads(std::unordered_set<pid_t> &pending, std::chrono::steady_clock::time_point deadline) {
+    std::unordered_set<pid_t> reported;
+    while (!pending.empty()) {
+        stop_event event{};
+        ++get_tracer_stats().waits;
+        event.tid = waitpid(-1, &event.status, __WALL | __WNOTHREAD | WNOHANG);
+        if (event.tid == 0) {
+            if (std::chrono::steady_clock::now() >= deadline) return false;
+            std::this_thread::sleep_for(std::chrono::microseconds{20});
+            continue;
+        }
+        if (event.tid < 0) {
+            m_exited = true;
+            return false;
+        }
+
+        pending.erase(event.tid);
+        if (event.exited()) {
+            if (event.tid == m_pid) {
+                m_exited = true;
+                return false;
+            }
+            remove_thread(event.tid);
+            continue;
+        }
+        ++get_tracer_stats().stops;
+        add_thread(event.tid);
+        reported.insert(event.tid);
+
+        auto &thread = m_threads.at(event.tid);
+        if (event.ptrace_event() == PTRACE_EVENT_CLONE) {
+            unsigned long new_tid = 0;
+            count_ptrace(PTRACE_GETEVENTMSG);
+            ptrace(PTRACE_GETEVENTMSG, event.tid, nullptr, &new_tid);
+            add_thread(new_tid);
+            if (!reported.count(new_tid)) pending.insert(new_tid);
+        } else if (event.is_trap() && thread.resume_request != PTRACE_SINGLESTEP) {
+            auto bp = m_breakpoints.find(thread.registers.get(reg::rip) - 1);
+            if (bp != m_breakpoints.end() && bp->second.is_enabled() && bp->second.get_kind() == breakpoint_kind::software) {
+                thread.registers.set(reg::rip, bp->first);
+            }
+        }
+    }
+    return true;
+}
+
+//every thread is stopped first, so none runs through code while it's being unpatched
+void debugger::detach(std::chrono::microseconds timeout) {
+    if (m_exited) return;
+
+    std::unordered_set<pid_t> pending;
+    if (!m_holding_threads) {
+        for (auto &entry : m_threads) {
+            if (&entry.second == m_thread) continue;
+            count_ptrace(PTRACE_INTERRUPT);
+            ptrace(PTRACE_INTERRUPT, entry.first, nullptr, nullptr);
+            pending.insert(entry.first);
+        }
+    }
+    if (!wait_for_threads(pending, std::chrono::steady_clock::now() + timeout)) {
+        if (m_exited) return;
+        std::cerr << pending.size() << " threads of " << m_pid << " didn't stop, detaching from the rest\n";
+    }
+
+    std::vector<std::intptr_t> addrs{};
+    for (const auto &bp : m_breakpoints) {
+        addrs.push_back(bp.first);
+    }
+    remove_breakpoints(addrs);
+    for (const auto &wp : m_watchpoints) {
+        m_debug_registers.clear(wp.first);
+    }
+    m_watchpoints.clear();
+    if (!m_scratch_original.empty()) {
+        write_memory(get_scratch_pad(), m_scratch_original.size(), m_scratch_original.data());
+        m_scratch_contents = 0;
+    }
+
+    for (auto &entry : m_threads) {
+        entry.second.registers.flush();
+        if (pending.count(entry.first)) continue;
+        count_ptrace(PTRACE_DETACH);
+        ptrace(PTRACE_DETACH, entry.first, nullptr, nullptr);
     }
+    m_exited = true;
+}
+
+void debugger::request_detach() {
+    m_detach_requested = true;
+    kill(m_pid, sample_signal);
 }
 
-void debugger::wait_for_signal() {
-    int wait_status;
-    auto options = 0;
-    waitpid(m_pid, &wait_status, options);
+//waits for the next stop of thread tid, or of any thread, and makes the stopped thread current
+void debugger::wait_for_signal(pid_t tid) {
+    stop_event event{};
+    while (true) {
+        m_waiting.store(true, std::memory_order_relaxed);
+        event.tid = timed_waitpid(tid, &event.status, __WALL | __WNOTHREAD);
+        m_waiting.store(false, std::memory_order_relaxed);
+        if (event.tid < 0) {
+            m_exited = true;
+            return;
+        }
+
+        if (event.exited()) {
+            if (event.tid == m_pid) {
+                m_exited = true;
+                return;
+            }
+            remove_thread(event.tid);
+            if (event.tid == tid) tid = -1; //it died while we waited on it, take whatever comes next
+            continue;
+        }
+        ++get_tracer_stats().stops;
+
+        if (!handle_thread_event(event)) break;
+    }
+    m_thread = &m_threads.at(event.tid);
+
+    if (event.is_trap()) {
+        if (auto code = infer_trap_code()) {
+            siginfo_t info{};
+            info.si_signo = SIGTRAP;
+            info.si_code = code;
+            handle_sigtrap(info);
+            return;
+        }
+    }
 
     auto siginfo = get_signal_info();
+    //before the stop is handled, so the block's lines are counted ahead of a breakpoint's
+    if (m_blocks && m_thread->resume_request == PTRACE_SINGLEBLOCK) account_block(siginfo);
 
     switch (siginfo.si_signo) {
         case SIGTRAP:
             handle_sigtrap(siginfo);
             break;
         case SIGSEGV:
-            std::cout << "Yay, segfault. Reason: " << siginfo.si_code << std::endl;
+            m_out << "Yay, segfault. Reason: " << siginfo.si_code << std::endl;
             break;
         default:
-            std::cout << "Got signal " << strsignal(siginfo.si_signo) << std::endl;
+            if (siginfo.si_signo == sample_signal && siginfo.si_code == SI_USER && siginfo.si_pid == getpid()) {
+                if (m_samples) record_sample();
+                break;
+            }
+            m_out << "Got signal " << strsignal(siginfo.si_signo) << std::endl;
     }
 }
 
+//why the current thread trapped, worked out from how it was resumed so that GETSIGINFO can be
+//skipped, or 0 when only siginfo can tell. a watchpoint can fire after any instruction, but a
+//hardware breakpoint only stops a thread at its own address, so with just those the rest is known
+int debugger::infer_trap_code() {
+    auto hardware = m_debug_registers.in_use();
+    if (hardware && !m_watchpoints.empty()) return 0;
+    if (m_thread->resume_request == PTRACE_SINGLESTEP) {
+        return hardware && at_hardware_breakpoint() ? 0 : TRAP_TRACE;
+    }
+    //a block ending on the instruction after a breakpoint looks just like hitting it
+    if (m_thread->resume_request == PTRACE_SINGLEBLOCK) return 0;
+    if (hardware && at_hardware_breakpoint()) return 0;
+
+    auto bp = m_breakpoints.find(get_pc() - 1);
+    if (bp != m_breakpoints.end() && bp->second.is_enabled() && bp->second.get_kind() == breakpoint_kind::software) {
+        return TRAP_BRKPT;
+    }
+    return 0;
+}
+
+bool debugger::at_hardware_breakpoint() {
+    auto bp = m_breakpoints.find(get_pc());
+    return bp != m_breakpoints.end() && bp->second.is_enabled() && bp->second.get_kind() == breakpoint_kind::hardware;
+}
+
+void debugger::set_resume_flag() {
+    m_thread->registers.set(reg::rflags, m_thread->registers.get(reg::rflags) | resume_flag);
+}
+
+//stops at breakpoints whose filters turned them down aren't returned: the thread is restarted
 void debugger::continue_execution() {
-    step_over_breakpoint();
-    ptrace(PTRACE_CONT, m_pid, nullptr, nullptr);
-    wait_for_signal();
+    do {
+        m_skip_stop = false;
+        if (at_hardware_breakpoint()) {
+            set_resume_flag(); //the CPU steps past it by itself
+        } else {
+            auto stepping = m_thread->tid;
+            step_over_breakpoint();
+            if (m_exited) return;
+            if (m_thread->tid != stepping) continue;
+        }
+        resume(*m_thread, PTRACE_CONT);
+        wait_for_signal();
+    } while (m_skip_stop && !finished());
 }
 
+//only this thread's stop will do: the caller goes on to look at its registers
 void debugger::single_step_instruction() {
-    ptrace(PTRACE_SINGLESTEP, m_pid, nullptr, nullptr);
-    wait_for_signal();
+    resume(*m_thread, PTRACE_SINGLESTEP);
+    wait_for_signal(m_thread->tid);
 }
 
 void debugger::step_over_breakpoint() {
     if (m_breakpoints.count(get_pc())) {
         auto &bp = m_breakpoints[get_pc()];
         if (bp.is_enabled()) {
-            bp.disable();
-            single_step_instruction();
-            bp.enable();
+            if (bp.get_kind() == breakpoint_kind::hardware) {
+                set_resume_flag();
+                single_step_instruction();
+            } else if (!displaced_step(bp)) {
+                bp.disable();
+                single_step_instruction();
+                bp.enable();
+            }
         }
     }
 }
 
-void debugger::step_over() {
-    auto func = get_function_from_pc(get_pc());
+//like gdb, run the copy from the program's entry point: _start never runs again once main has been
+//reached, it's executable, and it's close enough to the text for RIP-relative displacements
+uint64_t debugger::get_scratch_pad() {
+    return m_image->get_elf().get_hdr().entry + m_load_bias;
+}
+
+//the first time anything is written there
+void debugger::save_scratch_pad() {
+    if (m_scratch_original.empty()) {
+        m_scratch_original.resize(sizeof(displaced_instruction::bytes));
+        read_memory(get_scratch_pad(), m_scratch_original.size(), m_scratch_original.data());
+    }
+}
+
+bool debugger::scratch_pad_usable(std::size_t len) {
+    auto scratch = get_scratch_pad();
+    for (std::size_t i = 0; i < len + displaced_instruction::taken_offset; ++i) {
+        if (m_breakpoints.count(scratch + i)) return false;
+    }
+    return true;
+}
+
+auto debugger::get_displaced_instruction(const breakpoint& bp) -> const displaced_instruction& {
+    auto addr = bp.get_address();
+    auto cached = m_displaced.find(addr);
+    if (cached != m_displaced.end()) {
+        return cached->second;
+    }
+
+    //no breakpoint can sit inside the instruction, only on the ones after it
+    std::uint8_t code[16] = {};
+    auto n = read_memory(addr, sizeof(code), code);
+    code[0] = bp.get_saved_data();
+
+    auto scratch = get_scratch_pad();
+    return m_displaced[addr] = prepare_displaced_instruction(code, n, addr, scratch);
+}
+
+//executes the instruction under a software breakpoint without taking the breakpoint out, so there's
+//no window in which the site is unpatched and no write to put it back. false if it has to be done the old way
+bool debugger::displaced_step(const breakpoint& bp) {
+    using kind = displaced_instruction::kind;
+
+    auto& insn = get_displaced_instruction(bp);
+    auto addr = static_cast<uint64_t>(bp.get_address());
+    auto next = addr + insn.len;
+
+    switch (insn.type) {
+        case kind::unsupported:
+            return false;
+        case kind::jump:
+            set_pc(insn.target);
+            return true;
+        case kind::call: {
+            auto sp = m_thread->registers.get(reg::rsp) - 8;
+            if (!write_memory(sp, sizeof(next), &next)) return false;
+            m_thread->registers.set(reg::rsp, sp);
+            set_pc(insn.target);
+            return true;
+        }
+        default:
+            break;
+    }
+
+    if (!scratch_pad_usable(insn.len)) return false;
+
+    auto scratch = get_scratch_pad();
+    save_scratch_pad();
+    if (m_scratch_contents != bp.get_address()) {
+        if (!write_memory(scratch, insn.len, insn.bytes.data())) return false;
+        m_scratch_contents = bp.get_address();
+    }
+
+    auto stepping = m_thread->tid;
+    set_pc(scratch);
+    single_step_instruction();
+    if (m_exited || m_thread->tid != stepping) return true;
+
+    auto pc = get_pc();
+    if (pc == scratch) {
+        //stopped by a signal before the instruction ran
+        set_pc(addr);
+        return true;
+    }
+
+    if (insn.type == kind::call_indirect) {
+        auto sp = m_thread->registers.get(reg::rsp);
+        write_memory(sp, sizeof(next), &next);
+    }
+
+    if (pc == scratch + insn.len) {
+        set_pc(next);
+    } else if (insn.type == kind::branch && pc == scratch + insn.len + displaced_instruction::taken_offset) {
+        set_pc(insn.target);
+    }
+    return true;
+}
+
+const std::vector<std::intptr_t> &debugger::get_step_over_sites(const dwarf::die &func) {
     auto func_entry = at_low_pc(func);
+    auto cached = m_step_over_sites.find(func_entry);
+    if (cached != m_step_over_sites.end()) {
+        return cached->second;
+    }
+
     auto func_end = at_high_pc(func);
+    auto line = get_line_entry_from_pc(func_entry + m_load_bias);
+
+    std::vector<std::intptr_t> sites{};
+    while (line->address < func_end) {
+        sites.push_back(line->address + m_load_bias);
+        ++line;
+    }
+
+    return m_step_over_sites[func_entry] = std::move(sites);
+}
 
-    auto line = get_line_entry_from_pc(func_entry);
+void debugger::step_over() {
+    auto func = get_function_from_pc(get_pc());
     auto start_line = get_line_entry_from_pc(get_pc());
 
     std::vector<std::intptr_t> breakpoints_to_remove{};
 
-    //set breakpoints on all lines apart from the current one if they don't already have one set
-    while (line->address < func_end) {
-        if (line->address != start_line->address && !m_breakpoints.count(line->address)) {
-            set_breakpoint_at_address(line->address);
-            breakpoints_to_remove.push_back(line->address);
+    //set breakpoints on all lines apart from the current one if they don't already have one set.
+    //the ones that do are step targets too, so their filters don't get to run past them
+    for (auto addr : get_step_over_sites(func)) {
+        if (addr == static_cast<std::intptr_t>(start_line->address + m_load_bias)) continue;
+        m_step_targets.insert(addr);
+        if (!m_breakpoints.count(addr) &&
+            std::find(breakpoints_to_remove.begin(), breakpoints_to_remove.end(), addr) == breakpoints_to_remove.end()) {
+            breakpoints_to_remove.push_back(addr);
         }
-        ++line;
     }
 
     //set breakpoint on return address
-    auto frame_pointer = get_register_value(m_pid, reg::rbp);
-    auto return_address = read_memory(frame_pointer + 8);
-    if (!m_breakpoints.count(return_address)) {
-        set_breakpoint_at_address(return_address);
+    auto return_address = get_return_address();
+    m_step_targets.insert(return_address);
+    if (!m_breakpoints.count(return_address) &&
+        std::find(breakpoints_to_remove.begin(), breakpoints_to_remove.end(), return_address) == breakpoints_to_remove.end()) {
         breakpoints_to_remove.push_back(return_address);
     }
 
+    set_breakpoints_at_addresses(breakpoints_to_remove);
+
     continue_execution();
 
-    for (auto addr : breakpoints_to_remove) {
-        remove_breakpoint(addr);
-    }
+    m_step_targets.clear();
+    remove_breakpoints(breakpoints_to_remove);
 }
 
 void debugger::step_out() {
-    auto frame_pointer = get_register_value(m_pid, reg::rbp);
-    auto return_address = read_memory(frame_pointer + 8);
+    auto return_address = get_return_address();
 
     bool should_remove_breakpoint = false;
     if (!m_breakpoints.count(return_address)) {
@@ -257,7 +920,9 @@ void debugger::step_out() {
         should_remove_breakpoint = true;
     }
 
+    m_step_targets.insert(return_address);
     continue_execution();
+    m_step_targets.clear();
 
     if (should_remove_breakpoint) {
         remove_breakpoint(return_address);
@@ -280,13 +945,14 @@ void debugger::single_step_instruction_with_breakpoint_check() {
     if (m_breakpoints.count(get_pc())) {
         step_over_breakpoint();
     } else {
-        single_step_instruction();
+        //any thread may report first: one blocked in a syscall could wait forever on another one
+        resume(*m_thread, PTRACE_SINGLESTEP);
+        wait_for_signal();
     }
 
-    auto line_entry = get_line_entry_from_pc(get_pc());
-
-    print_source_advice(line_entry->file->path, line_entry->line);
+    if (m_exited) return;
 
+    print_source_advice(get_line_from_pc(get_pc()));
 }
 
 void debugger::remove_breakpoint(std::intptr_t addr) {
@@ -294,116 +960,301 @@ void debugger::remove_breakpoint(std::intptr_t addr) {
         m_breakpoints.at(addr).disable();
     }
     m_breakpoints.erase(addr);
+    m_breakpoint_filters.erase(addr);
 }
 
 void debugger::set_breakpoint_at_address(std::intptr_t addr) {
     //std::cout << "Set breakpoint at address 0x" << std::hex << addr << std::endl;
-    breakpoint bp{m_pid, addr};
+    breakpoint bp{m_memory, m_debug_registers, addr};
     bp.enable();
     m_breakpoints[addr] = bp;
 }
 
-void debugger::set_breakpoint_at_function(const std::string &name) {
-    for (const auto &cu : m_dwarf.compilation_units()) {
-        for (const auto &die : cu.root()) {
-            if (die.has(dwarf::DW_AT::name) && at_name(die) == name) {
-                auto low_pc = at_low_pc(die);
-                auto entry = get_line_entry_from_pc(low_pc);
-                ++entry; //skip prologue
-                set_breakpoint_at_address(entry->address);
-            }
+void debugger::set_breakpoints_at_addresses(const std::vector<std::intptr_t> &addrs) {
+    std::vector<breakpoint *> bps{};
+    for (auto addr : addrs) {
+        auto &bp = m_breakpoints[addr] = breakpoint{m_memory, m_debug_registers, addr};
+        bps.push_back(&bp);
+    }
+    breakpoint::enable_all(m_memory, std::move(bps));
+}
+
+void debugger::remove_breakpoints(const std::vector<std::intptr_t> &addrs) {
+    std::vector<breakpoint *> bps{};
+    for (auto addr : addrs) {
+        auto &bp = m_breakpoints.at(addr);
+        if (bp.is_enabled()) {
+            bps.push_back(&bp);
+        }
+    }
+    breakpoint::disable_all(m_memory, std::move(bps));
+
+    for (auto addr : addrs) {
+        m_breakpoints.erase(addr);
+        m_breakpoint_filters.erase(addr);
+    }
+}
+
+std::vector<std::intptr_t> debugger::set_breakpoint_at_function(const std::string &name) {
+    std::vector<std::intptr_t> addrs{};
+    auto names = m_image->lookup_name(name);
+    if (!names) return addrs;
+
+    for (const auto &die : names->functions) {
+        auto low_pc = at_low_pc(die);
+        auto entry = get_line_entry_from_pc(low_pc + m_load_bias);
+        ++entry; //skip prologue
+        set_breakpoint_at_address(entry->address + m_load_bias);
+        addrs.push_back(entry->address + m_load_bias);
+    }
+    return addrs;
+}
+
+void debugger::set_breakpoints_on_all_lines() {
+    std::vector<std::intptr_t> addrs{};
+    for (auto addr : m_image->get_statement_addresses()) {
+        if (!m_breakpoints.count(addr + m_load_bias)) {
+            addrs.push_back(addr + m_load_bias);
         }
     }
+    set_breakpoints_at_addresses(addrs);
 }
 
-void debugger::set_breakpoint_at_source_line(const std::string &file, unsigned line) {
-    for (const auto &cu : m_dwarf.compilation_units()) {
+std::vector<std::intptr_t> debugger::set_breakpoint_at_source_line(const std::string &file, unsigned line) {
+    for (const auto &cu : m_image->get_dwarf().compilation_units()) {
         if (is_suffix(file, at_name(cu.root()))) {
             const auto &lt = cu.get_line_table();
 
             for (const auto &entry : lt) {
                 if (entry.is_stmt && entry.line == line) {
-                    set_breakpoint_at_address(entry.address);
-                    return;
+                    set_breakpoint_at_address(entry.address + m_load_bias);
+                    return {static_cast<std::intptr_t>(entry.address + m_load_bias)};
                 }
             }
         }
     }
+    return {};
 }
 
 void debugger::dump_registers() {
     for (const auto &rd : g_register_descriptors) {
         std::cout << rd.name << " 0x"
-                  << std::setfill('0') << std::setw(16) << std::hex << get_register_value(m_pid, rd.r) << std::endl;
+                  << std::setfill('0') << std::setw(16) << std::hex << m_thread->registers.get(rd.r) << std::endl;
     }
 }
 
 class ptrace_expr_context : public dwarf::expr_context {
 public:
-    ptrace_expr_context(pid_t pid) : m_pid{pid} {}
+    ptrace_expr_context(register_cache &registers, process_memory &memory) : m_registers{registers}, m_memory{memory} {}
 
     dwarf::taddr reg(unsigned regnum) override {
-        return get_register_value_from_dwarf_register(m_pid, regnum);
+        return m_registers.get_dwarf(regnum);
     }
 
     dwarf::taddr pc() override {
-        struct user_regs_struct regs;
-        ptrace(PTRACE_GETREGS, m_pid, nullptr, &regs);
-        return regs.rip;
+        return m_registers.get(reg::rip);
     }
 
     dwarf::taddr deref_size(dwarf::taddr address, unsigned size) override {
-        //TODO take into account size
-        return ptrace(PTRACE_PEEKDATA, m_pid, address, nullptr);
+        dwarf::taddr value = 0;
+        m_memory.read(address, &value, std::min<std::size_t>(size, sizeof(value)));
+        return value;
     }
 
 private:
-    pid_t m_pid;
+    register_cache &m_registers;
+    process_memory &m_memory;
 };
 
-void debugger::read_variables() {
-    using namespace dwarf;
-
-    auto func = get_function_from_pc(get_pc());
+//locations are decoded once per function and debuggee, so a trace can look them up at every stop
+const function_variables &debugger::get_function_variables(const dwarf::die &func) {
+    auto func_entry = at_low_pc(func);
+    auto cached = m_function_variables.find(func_entry);
+    if (cached != m_function_variables.end()) {
+        return cached->second;
+    }
+    return m_function_variables[func_entry] = compile_function_variables(func, m_image->get_elf());
+}
 
-    for (const auto &die : func) {
-        if (die.tag == DW_TAG::variable) {
-            auto loc_val = die[DW_AT::location];
-
-            //only supports exprlocs for now
-            if (loc_val.get_type() == value::type::exprloc) {
-                ptrace_expr_context context{m_pid};
-                auto result = loc_val.as_exprloc().evaluate(&context);
-
-                switch (result.location_type) {
-                    case expr_result::type::address: {
-                        auto value = read_memory(result.value);
-                        std::cout << at_name(die) << " (0x" << std::hex << result.value << ") = " << value << std::endl;
-                        break;
-                    }
-
-                    case expr_result::type::reg: {
-                        auto value = get_register_value_from_dwarf_register(m_pid, result.value);
-                        std::cout << at_name(die) << " (reg " << result.value << ") = " << value << std::endl;
-                        break;
-                    }
-
-                    default:
-                        throw std::runtime_error{"Unhandled variable location"};
-                }
+variable_place debugger::locate_variable(const function_variables &frame, const local_variable &var) {
+    using kind = variable_location::kind;
+    auto &registers = m_thread->registers;
+    auto pc = get_pc() - m_load_bias;
+
+    auto location = find_location(var.ranges, pc);
+    if (!location) return variable_place{};
+
+    switch (location->type) {
+        case kind::address:
+            return variable_place{variable_place::kind::memory, location->offset + m_load_bias};
+        case kind::register_offset:
+            return variable_place{variable_place::kind::memory, registers.get_dwarf(location->reg) + location->offset};
+        case kind::in_register:
+            return variable_place{variable_place::kind::reg, location->reg};
+        case kind::frame_offset: {
+            auto base = find_location(frame.frame_base, pc);
+            if (!base) return variable_place{};
+
+            uint64_t base_address;
+            if (base->type == kind::register_offset) {
+                base_address = registers.get_dwarf(base->reg) + base->offset;
+            } else if (base->type == kind::in_register) {
+                base_address = registers.get_dwarf(base->reg);
+            } else if (base->type == kind::call_frame_cfa) {
+                //the unwinder knows it once it has been past the frame. without CFI, assume frame
+                //pointers and a finished prologue: the saved rbp and return address sit below it
+                const auto &frames = get_call_stack(2);
+                base_address = frames.front().has_cfa ? frames.front().cfa : registers.get(reg::rbp) + 16;
             } else {
-                throw std::runtime_error{"Unhandled variable location"};
+                return variable_place{};
             }
+            return variable_place{variable_place::kind::memory, base_address + location->offset};
         }
-    }
-}
+        case kind::expression: {
+            try {
+                ptrace_expr_context context{registers, m_memory};
+                auto result = var.die[dwarf::DW_AT::location].as_exprloc().evaluate(&context);
+                if (result.location_type == dwarf::expr_result::type::address) {
+                    return variable_place{variable_place::kind::memory, result.value};
+                }
+                if (result.location_type == dwarf::expr_result::type::reg) {
+                    return variable_place{variable_place::kind::reg, result.value};
+                }
+            } catch (std::exception &) {}
+            return variable_place{};
+        }
+        default:
+            return variable_place{};
+    }
+}
+
+void debugger::read_variables() {
+    auto func = get_function_from_pc(get_pc());
+    const auto &frame = get_function_variables(func);
+
+    for (const auto &var : frame.variables) {
+        auto place = locate_variable(frame, var);
+        switch (place.type) {
+            case variable_place::kind::memory: {
+                uint64_t value = 0;
+                read_memory(place.value, std::min(var.size, sizeof(value)), &value);
+                m_out << var.name << " (0x" << std::hex << place.value << std::dec << ") = " << value << "\n";
+                break;
+            }
+            case variable_place::kind::reg:
+                m_out << var.name << " (reg " << place.value << ") = " << m_thread->registers.get_dwarf(place.value) << "\n";
+                break;
+            case variable_place::kind::nowhere:
+                if (!var.ranges.empty()) m_out << var.name << " <optimized out>\n";
+                break;
+        }
+    }
+}
+
+//locals and parameters of the current function first, then globals
+bool debugger::find_variable(const std::string &name, uint64_t &address, std::size_t &size) {
+    using namespace dwarf;
+
+    auto locate = [&](const die &var) {
+        if (!var.has(DW_AT::name) || at_name(var) != name || !var.has(DW_AT::location)) return false;
+
+        auto loc_val = var[DW_AT::location];
+        if (loc_val.get_type() != value::type::exprloc) return false;
+
+        ptrace_expr_context context{m_thread->registers, m_memory};
+        auto result = loc_val.as_exprloc().evaluate(&context);
+        if (result.location_type != expr_result::type::address) return false;
+
+        //a global's expression is a DW_OP_addr, which is a link address
+        address = result.value + m_load_bias;
+        size = variable_size(var);
+        return true;
+    };
+
+    //innermost scopes come last, and shadow what the outer ones declare
+    try {
+        const auto &frame = get_function_variables(get_function_from_pc(get_pc()));
+        for (auto var = frame.variables.rbegin(); var != frame.variables.rend(); ++var) {
+            if (var->name != name) continue;
+            auto place = locate_variable(frame, *var);
+            if (place.type == variable_place::kind::memory) {
+                address = place.value;
+                size = var->size;
+                return true;
+            }
+        }
+    } catch (std::out_of_range &) {}
+
+    for (const auto &cu : m_image->get_dwarf().compilation_units()) {
+        for (const auto &die : cu.root()) {
+            if (die.tag == DW_TAG::variable && locate(die)) return true;
+        }
+    }
+    return false;
+}
+
+void debugger::set_watchpoint_on_variable(const std::string &name) {
+    uint64_t address;
+    std::size_t size;
+    if (!find_variable(name, address, size)) {
+        std::cerr << "Cannot find variable " << name << "\n";
+        return;
+    }
+    set_watchpoint(address, size, name);
+}
+
+void debugger::set_watchpoint(uint64_t address, std::size_t len, const std::string &name) {
+    //debug registers only watch 1, 2, 4 or 8 bytes, aligned to their size
+    std::size_t watched = 8;
+    while (watched > 1 && (watched > len || address % watched != 0)) {
+        watched /= 2;
+    }
+
+    auto slot = m_debug_registers.set(address, hw_breakpoint_type::write, watched);
+    if (slot < 0) {
+        std::cerr << "No free debug register\n";
+        return;
+    }
+
+    uint64_t value = 0;
+    read_memory(address, watched, &value);
+    m_watchpoints[slot] = watchpoint{name, address, watched, value};
+    std::cout << "Watchpoint " << slot << ": " << name << " (0x" << std::hex << address << ", "
+              << std::dec << watched << " bytes)" << std::endl;
+}
 
 uint64_t debugger::read_memory(uint64_t address) {
-    return ptrace(PTRACE_PEEKDATA, m_pid, address, nullptr);
+    uint64_t value = 0;
+    m_memory.read(address, &value, sizeof(value));
+    return value;
+}
+
+std::size_t debugger::read_memory(uint64_t address, std::size_t len, void *buffer) {
+    return m_memory.read(address, buffer, len);
 }
 
 void debugger::write_memory(uint64_t address, uint64_t value) {
-    ptrace(PTRACE_POKEDATA, m_pid, address, value);
+    m_memory.write(address, &value, sizeof(value));
+}
+
+bool debugger::write_memory(uint64_t address, std::size_t len, const void *buffer) {
+    return m_memory.write(address, buffer, len);
+}
+
+void debugger::dump_memory(uint64_t address, std::size_t len) {
+    std::vector<uint8_t> buffer(len);
+    auto n = read_memory(address, len, buffer.data());
+
+    for (std::size_t row = 0; row < n; row += 16) {
+        std::cout << "0x" << std::setfill('0') << std::setw(16) << std::hex << address + row << ':';
+        for (std::size_t i = row; i < n && i < row + 16; ++i) {
+            std::cout << ' ' << std::setw(2) << static_cast<unsigned>(buffer[i]);
+        }
+        std::cout << std::endl;
+    }
+    if (n < len) {
+        std::cerr << "Could only read " << std::dec << n << " of " << len << " bytes\n";
+    }
 }
 
 std::vector<std::string> split(const std::string &s, char delimiter) {
@@ -418,23 +1269,65 @@ std::vector<std::string> split(const std::string &s, char delimiter) {
     return out;
 }
 
-void debugger::print_backtrace() {
-    auto current_func = get_function_from_pc(get_pc());
+//the current thread's stack, unwound through the CFI until it's depth frames deep or can't go further.
+//frames are kept until the thread runs again, so asking for more only unwinds the new ones
+const std::vector<stack_frame> &debugger::get_call_stack(std::size_t depth) {
+    auto &stack = m_thread->stack;
+    if (stack.frames.empty()) {
+        stack_frame top{};
+        for (unsigned r = 0; r < cfi_return_address; ++r) {
+            top.regs[r] = m_thread->registers.get_dwarf(r);
+        }
+        top.pc = top.regs[cfi_return_address] = get_pc();
+        top.known = (1u << n_cfi_registers) - 1;
+        stack.frames.push_back(top);
+    }
 
-    auto output_frame = [frame_number = 0](auto &&func) mutable {
-        std::cout << "frame #" << frame_number++ << ": 0x" << dwarf::at_low_pc(func)
-                  << ' ' << dwarf::at_name(func) << std::endl;
+    auto read = [this](uint64_t address, uint64_t &value) {
+        return read_memory(address, sizeof(value), &value) == sizeof(value);
     };
+    while (stack.frames.size() < depth && !stack.complete) {
+        auto &frame = stack.frames.back();
+        //a caller's pc is a return address, which can be just past the end of the calling function
+        auto pc = (stack.frames.size() == 1 ? frame.pc : frame.pc - 1) - m_load_bias;
+
+        frame_row row;
+        stack_frame caller;
+        auto fde = m_image->get_call_frames().find(pc, m_frame_hint);
+        if (!fde || !call_frame_table::find_row(*fde, pc, row) ||
+            !unwind_frame(frame, row, fde->cie->return_register, read, caller)) {
+            stack.complete = true;
+            break;
+        }
+        //the stack grows down, so each caller's CFA is above its callee's. one that isn't means the
+        //CFI or the stack is corrupt, and following it could go round in circles
+        auto n = stack.frames.size();
+        if (n >= max_call_depth || (n > 1 && stack.frames[n - 2].has_cfa && frame.cfa <= stack.frames[n - 2].cfa)) {
+            stack.complete = true;
+            break;
+        }
+        stack.frames.push_back(caller);
+    }
+    return stack.frames;
+}
 
-    output_frame(current_func);
+//where the current function returns to: from the CFI, or through the rbp chain where there's none
+uint64_t debugger::get_return_address() {
+    const auto &frames = get_call_stack(2);
+    if (frames.size() > 1) return frames[1].pc;
+    return read_memory(m_thread->registers.get(reg::rbp) + 8);
+}
 
-    auto frame_pointer = get_register_value(m_pid, reg::rbp);
-    auto return_address = read_memory(frame_pointer + 8);
-    while (dwarf::at_name(current_func) != "main") {
-        current_func = get_function_from_pc(return_address);
-        output_frame(current_func);
-        frame_pointer = read_memory(frame_pointer);
-        return_address = read_memory(frame_pointer + 8);
+void debugger::print_backtrace() {
+    for (std::size_t i = 0;; ++i) {
+        const auto &frames = get_call_stack(i + 1);
+        if (i >= frames.size()) break;
+
+        auto pc = (i == 0 ? frames[i].pc : frames[i].pc - 1) - m_load_bias;
+        auto func = m_image->find_function(pc, m_function_hint);
+        std::cout << "frame #" << i << ": 0x" << std::hex << (func ? dwarf::at_low_pc(*func) + m_load_bias : frames[i].pc) << std::dec
+                  << ' ' << (func ? dwarf::at_name(*func) : std::string{"??"}) << std::endl;
+        if (func && dwarf::at_name(*func) == "main") break;
     }
 }
 
@@ -445,14 +1338,40 @@ void debugger::handle_command(const std::string &line) {
     if (is_prefix(command, "cont")) {
         continue_execution();
     } else if (is_prefix(command, "break")) {
+        //break LOCATION [ignore N] [if CONDITION]
+        std::vector<std::intptr_t> addrs{};
         if (args[1][0] == '0' && args[1][1] == 'x') {
             std::string addr{args[1], 2};
             set_breakpoint_at_address(std::stol(addr, 0, 16));
+            addrs.push_back(std::stol(addr, 0, 16));
         } else if (args[1].find(':') != std::string::npos) {
             auto file_and_line = split(args[1], ':');
-            set_breakpoint_at_source_line(file_and_line[0], std::stoi(file_and_line[1]));
+            addrs = set_breakpoint_at_source_line(file_and_line[0], std::stoi(file_and_line[1]));
         } else {
-            set_breakpoint_at_function(args[1]);
+            addrs = set_breakpoint_at_function(args[1]);
+        }
+
+        std::size_t next = 2;
+        unsigned ignore_count = 0;
+        if (next + 1 < args.size() && args[next] == "ignore") {
+            ignore_count = std::stoul(args[next + 1]);
+            next += 2;
+        }
+        std::string condition;
+        if (next < args.size() && args[next] == "if") {
+            for (auto i = next + 1; i < args.size(); ++i) {
+                condition += args[i] + ' ';
+            }
+            if (condition.empty()) {
+                std::cerr << "Missing condition\n";
+                for (auto addr : addrs) {
+                    remove_breakpoint(addr);
+                }
+                return;
+            }
+        }
+        if (ignore_count > 0 || !condition.empty()) {
+            set_breakpoint_filter(addrs, ignore_count, condition);
         }
     } else if (is_prefix(command, "step")) {
         step_in();
@@ -467,20 +1386,26 @@ void debugger::handle_command(const std::string &line) {
     } else if (is_prefix(command, "status")) {
         auto line_entry = get_line_entry_from_pc(get_pc());
         print_source(line_entry->file->path, line_entry->line);
+    } else if (command == "stats") {
+        get_hot_path_stats().write_report(std::cout);
     } else if (is_prefix(command, "register")) {
         if (is_prefix(args[1], "dump")) {
             dump_registers();
         } else if (is_prefix(args[1], "read")) {
-            std::cout << get_register_value(m_pid, get_register_from_name(args[2])) << std::endl;
+            std::cout << m_thread->registers.get(get_register_from_name(args[2])) << std::endl;
         } else if (is_prefix(args[1], "write")) {
             std::string val{args[3], 2}; //assume 0xVAL
-            set_register_value(m_pid, get_register_from_name(args[2]), std::stol(val, 0, 16));
+            m_thread->registers.set(get_register_from_name(args[2]), std::stol(val, 0, 16));
         }
     } else if (is_prefix(command, "memory")) {
         std::string addr{args[2], 2}; //assume 0xADDRESS
 
         if (is_prefix(args[1], "read")) {
-            std::cout << std::hex << read_memory(std::stol(addr, 0, 16)) << std::endl;
+            if (args.size() > 3) {
+                dump_memory(std::stol(addr, 0, 16), std::stoul(args[3], 0, 0));
+            } else {
+                std::cout << std::hex << read_memory(std::stol(addr, 0, 16)) << std::endl;
+            }
         }
         if (is_prefix(args[1], "write")) {
             std::string val{args[3], 2}; //assume 0xVAL
@@ -490,10 +1415,17 @@ void debugger::handle_command(const std::string &line) {
         read_variables();
     } else if (is_prefix(command, "backtrace")) {
         print_backtrace();
+    } else if (is_prefix(command, "watch")) {
+        if (args[1][0] == '0' && args[1][1] == 'x') {
+            std::string addr{args[1], 2};
+            set_watchpoint(std::stol(addr, 0, 16), sizeof(uint64_t), args[1]);
+        } else {
+            set_watchpoint_on_variable(args[1]);
+        }
     } else if (is_prefix(command, "symbol")) {
         auto syms = lookup_symbol(args[1]);
         for (auto &&s : syms) {
-            std::cout << s.name << ' ' << to_string(s.type) << " 0x" << std::hex << s.addr << std::endl;
+            std::cout << s.name << ' ' << to_string(s.type) << " 0x" << std::hex << s.addr + m_load_bias << std::endl;
         }
     } else {
         std::cerr << "Unknown command\n";
@@ -509,219 +1441,860 @@ void execute_debugee(const std::string &prog_name) {
 }
 
 
-int CountLines(const char *filename) {
-    std::ifstream ReadFile;
-    int n = 0;
-    std::string tmp;
-    ReadFile.open(filename, std::ios::in);//ios::in 表示以只读的方式读取文件
-    if (ReadFile.fail())//文件打开失败:返回0
-    {
-        return 0;
-    } else//文件存在
-    {
-        while (getline(ReadFile, tmp, '\n')) {
-            n++;
+void debugger::print_source_advice(const line_row &row) {
+
+    if (m_thread->last_line == row.id)return;
+
+    m_thread->last_line = row.id;
+    ++line_counts[row.id];
+
+    if (m_sink && m_sink->wants_lines()) {
+        m_sink->line_reached(m_out, m_image->get_sources().get_file(row.entry->file->path), row.entry->line);
+    }
+
+    if (m_trace_variables) {
+        try {
+            read_variables();
+        } catch (std::out_of_range &) {}
+    }
+}
+
+
+void debugger::step_in_advice() {
+    auto line = get_line_entry_from_pc(get_pc())->line;
+
+    while (!finished() && get_line_entry_from_pc(get_pc())->line == line) {
+        single_step_instruction_with_breakpoint_check();
+    }
+}
+
+bool debugger::has_line_info(uint64_t pc) {
+    hot_timer_scope timing{get_hot_path_stats().line_lookup};
+    return m_image->find_line_entry(pc - m_load_bias, m_line_hint) != nullptr;
+}
+
+//we single stepped out of the code we have line tables for, into libc, the loader or a PLT stub.
+//rather than stepping through it, run at full speed until control reaches user code again:
+//either through the return address of the call which got us here, or through a function entry
+//if the library calls back into us (qsort comparators, atexit handlers)
+void debugger::fast_forward_to_user_code() {
+    if (!m_entry_breakpoints_set) {
+        std::vector<std::intptr_t> entries{};
+        for (auto addr : m_image->get_function_entries()) {
+            if (!m_breakpoints.count(addr + m_load_bias)) {
+                entries.push_back(addr + m_load_bias);
+            }
         }
-        ReadFile.close();
-        return n;
+        set_breakpoints_at_addresses(entries);
+        m_entry_breakpoints_set = true;
+    }
+
+    while (!finished() && !has_line_info(get_pc())) {
+        //straight after a call the return address is on top of the stack. these breakpoints
+        //stay for the rest of the run: any hit on them is user code that really executed
+        auto return_address = read_memory(m_thread->registers.get(reg::rsp));
+        if (has_line_info(return_address) && !m_breakpoints.count(return_address)) {
+            set_breakpoint_at_address(return_address);
+        }
+        continue_execution();
     }
 }
 
-std::string ReadLine(const char *filename, int line) {
-    int lines, i = 0;
-    std::string temp;
-    std::fstream file;
-    file.open(filename, std::ios::in);
-    lines = CountLines(filename);
+//an attached process is long past main: start from wherever it is
+void debugger::run_to_main() {
+    if (m_attached) return;
+    set_breakpoint_at_function("main");
+    //a clone starts at main's first instruction, which is only the breakpoint if there's no prologue
+    if (m_started_at_main && m_breakpoints.count(get_pc())) {
+        handle_breakpoint_hit();
+    } else {
+        continue_execution();
+    }
+}
 
-    if (line <= 0) {
-        return "Error 1: 行数错误，不能为0或负数。";
+void debugger::runAdvice(bool fast_forward) {
+    wait_for_start();
+    //without fast forwarding other threads run free, since they start out in library code
+    if (fast_forward) m_new_thread_request = PTRACE_SINGLESTEP;
+    run_to_main();
+    //an attached process is usually stopped in a system call. stepping would leave "user code"
+    //straight away and run free to the end, so go to where it's next in code with line information
+    if (m_attached && !finished() && !has_line_info(get_pc())) {
+        fast_forward_to_user_code();
     }
-    if (file.fail()) {
-        return "Error 2: 文件不存在。";
+
+    while (!finished()) {
+        try {
+            step_in_advice();
+        } catch (std::out_of_range &) {
+            if (!fast_forward) {
+                //left user code: let every thread run to the end
+                while (!finished()) {
+                    continue_execution();
+                }
+                break;
+            }
+            fast_forward_to_user_code();
+        }
     }
-    if (line > lines) {
-        return "Error 3: 行数超出文件长度。";
+    for (auto &thread : m_threads) {
+        thread.second.last_line = no_line;
     }
-    while (getline(file, temp) && i < line - 1) {
-        i++;
+}
+
+//the kernel takes PTRACE_SINGLEBLOCK wherever the CPU has the flag for it, but some hypervisors
+//quietly ignore the flag and the thread single steps instead. two nops and a jump in the scratch pad
+//tell them apart: a block step stops past the jump, a single step after the first nop
+bool debugger::probe_block_step() {
+    static const uint8_t probe[] = {0x90, 0x90, 0xeb, 0x00, 0x90};
+    if (!scratch_pad_usable(sizeof(probe))) return false;
+
+    auto scratch = get_scratch_pad();
+    save_scratch_pad();
+    if (!write_memory(scratch, sizeof(probe), probe)) return false;
+    m_scratch_contents = 0;
+
+    auto pc = get_pc();
+    auto stepping = m_thread->tid;
+    set_pc(scratch);
+    if (!resume(*m_thread, PTRACE_SINGLEBLOCK)) {
+        set_pc(pc);
+        return false;
     }
-    file.close();
-    return temp;
+    wait_for_signal(stepping);
+    if (m_exited) return false;
+
+    auto stopped = get_pc();
+    set_pc(pc);
+    return stopped == scratch + 4;
 }
 
+//a stop at the end of a block, which ran from the thread's block_start: count the lines in between
+void debugger::account_block(const siginfo_t &info) {
+    auto start = m_thread->block_start - m_load_bias;
+    auto stop = get_pc() - m_load_bias;
+    auto taken_branch = false;
+    if (info.si_signo == SIGTRAP) {
+        switch (info.si_code) {
+            case SI_KERNEL:
+            case TRAP_BRKPT:
+                --stop; //the breakpoint itself hasn't run
+                break;
+            case TRAP_TRACE:
+            case TRAP_BRANCH:
+                taken_branch = true;
+                break;
+            default:
+                break;
+        }
+    }
+    //anything else stopped the thread before the instruction at the pc
+    for (auto row : m_blocks->find(start, stop, taken_branch)) {
+        print_source_advice(*row);
+    }
+}
 
-void debugger::print_source_advice(const std::string &file_name, unsigned line, unsigned n_lines_context) {
+//runs the current thread to its next taken branch. the lines are counted as it stops, in wait_for_signal
+void debugger::block_step() {
+    if (!has_line_info(get_pc())) {
+        fast_forward_to_user_code();
+        return;
+    }
 
-    if (last == line)return;
+    auto bp = m_breakpoints.find(get_pc());
+    if (bp != m_breakpoints.end() && bp->second.is_enabled()) {
+        //a branch trap stops before the int3 runs, so the breakpoint's line may not be counted yet.
+        //after a hit it was, and the repeat folds into it
+        print_source_advice(get_line_from_pc(get_pc()));
+        step_over_breakpoint();
+        return;
+    }
+    resume(*m_thread, PTRACE_SINGLEBLOCK);
+    wait_for_signal();
+}
 
-    last = line;
+//the counts of runAdvice(true) for a trap per taken branch instead of one per instruction, falling
+//back to single steps where block stepping doesn't work
+void debugger::run_block_coverage() {
+    wait_for_start();
+    //threads started before the probe single step, which works everywhere
+    m_new_thread_request = PTRACE_SINGLESTEP;
+    run_to_main();
+
+    if (!finished()) {
+        if (probe_block_step()) {
+            m_blocks.reset(new block_map{*m_image});
+            m_new_thread_request = PTRACE_SINGLEBLOCK;
+        } else {
+            std::cerr << "Block stepping isn't supported here, single stepping instead\n";
+        }
+    }
 
+    while (!finished()) {
+        if (m_blocks) {
+            block_step();
+            continue;
+        }
+        try {
+            step_in_advice();
+        } catch (std::out_of_range &) {
+            fast_forward_to_user_code();
+        }
+    }
+    m_blocks.reset();
+    for (auto &thread : m_threads) {
+        thread.second.last_line = no_line;
+    }
+}
 
-    //std::ifstream file {file_name};
-    auto start_line = line <= n_lines_context ? 1 : line - n_lines_context;
-    auto end_line = line + n_lines_context + (line < n_lines_context ? n_lines_context - line : 0) + 1;
+void debugger::run_line_coverage(bool first_hit_only) {
+    wait_for_start();
 
-    std::cout << "Now Execute--" << line << "Line" << "\n";
+    //one breakpoint per line table row, so the debuggee runs at full speed between lines
+    m_first_hit_only = first_hit_only;
+    set_breakpoints_on_all_lines();
+    if ((m_started_at_main || m_attached) && m_breakpoints.count(get_pc())) {
+        handle_breakpoint_hit();
+    }
 
-    auto ite = source_map.find(line);
-    if (ite == source_map.end()) {
-        source_map.insert(std::pair<int, int>(line, 1));
-    } else {
-        ite->second = ite->second + 1;
+    while (!finished()) {
+        continue_execution();
     }
 
+    for (auto &thread : m_threads) {
+        thread.second.last_line = no_line;
+    }
+}
 
-    std::cout << ReadLine(file_name.c_str(), line);
+//the stack as the CFI sees it, at link addresses for the aggregator. a full ring drops the sample
+void debugger::record_sample() {
+    profile_sample sample;
+    for (const auto &frame : get_call_stack(profile_sample::max_depth)) {
+        sample.pcs[sample.depth++] = frame.pc - m_load_bias;
+    }
+    m_samples->push(sample);
+}
+
+//a timer thread signals the debuggee rate times a second, and every stop that causes is a sample.
+//the signal is swallowed like any other, so the debuggee never sees it
+void debugger::run_profile(unsigned rate, sample_ring &samples) {
+    wait_for_start();
+    m_samples = &samples;
+
+    std::atomic<bool> done{false};
+    auto pid = m_pid;
+    std::thread timer{[&done, pid, rate] {
+        auto period = std::chrono::nanoseconds{1000000000 / std::max(1u, rate)};
+        auto next = std::chrono::steady_clock::now();
+        while (!done.load(std::memory_order_relaxed)) {
+            next += period;
+            std::this_thread::sleep_until(next);
+            if (!done.load(std::memory_order_relaxed)) kill(pid, sample_signal);
+        }
+    }};
+
+    while (!finished()) {
+        continue_execution();
+    }
 
-    std::cout << std::endl;
+    done = true;
+    timer.join();
+    m_samples = nullptr;
 }
 
+struct run_options {
+    coverage_mode mode = coverage_mode::step;
+    bool capture_stdout = false; //take the answer from the first line of stdout rather than 1.txt
+    bool fork_server = false;    //clone each test from one process stopped at main instead of exec'ing it
+    bool trace_variables = false; //dump the function's variables at every new line
+    unsigned sample_rate = 1000; //samples a second in profile mode
+    unsigned attach_seconds = 0; //how long to trace an attached process for; 0 is until it exits
+};
 
-void debugger::step_in_advice() {
-    auto line = get_line_entry_from_pc(get_pc())->line;
+//a thread that won't stop within this of being interrupted is probably in an uninterruptible
+//sleep, and waiting it out would stall everything else in the process
+static constexpr auto attach_timeout = std::chrono::milliseconds{100};
 
-    while (get_line_entry_from_pc(get_pc())->line == line) {
-        single_step_instruction_with_breakpoint_check();
+struct test_result {
+    bool passed;
+    line_set covered; //bits rather than counts, so a large suite's results stay small
+    std::unordered_map<std::string, std::uint64_t> stacks; //folded stacks and their samples, when profiling
+};
+
+//the debuggee's output from the start of the file behind fd: all of it, or up to the first newline
+std::string read_output(int fd, bool whole) {
+    std::string output;
+    char buffer[4096];
+    off_t offset = 0;
+    ssize_t n;
+    while ((n = pread(fd, buffer, sizeof(buffer), offset)) > 0) {
+        auto end = whole ? buffer + n : std::find(buffer, buffer + n, '\n');
+        output.append(buffer, end);
+        if (end != buffer + n) break;
+        offset += n;
     }
+    return output;
+}
 
-    auto line_entry = get_line_entry_from_pc(get_pc());
+//an anonymous file holding data, for the debuggee to read as its stdin
+int make_input_file(text_view data) {
+    auto fd = memfd_create("minidbg-stdin", MFD_CLOEXEC);
+    if (fd < 0) return -1;
+
+    std::size_t done = 0;
+    while (done < data.size) {
+        auto n = write(fd, data.data + done, data.size - done);
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        done += n;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
 }
 
+//what a cached result depends on besides the binary and the test itself. -V only adds to the
+//transcript, which isn't cached, and -j gives the same results as one job
+std::uint64_t cache_salt(const run_options &options) {
+    return static_cast<std::uint64_t>(options.mode) << 2 | options.fork_server << 1 | options.capture_stdout;
+}
 
-void debugger::runAdvice() {
-    int wait_status;
-    auto options = 0;
-    waitpid(m_pid, &wait_status, options);
+//traces one test case from fork to verdict, and hands its coverage to sink. work_dir is where
+//the debuggee runs and writes its answer; empty means the current directory. with a server the
+//debuggee is cloned from it rather than exec'd, and runs wherever the server was started. a test
+//found in the cache isn't run at all, and one that's traced is added to it
+test_result run_test(const std::shared_ptr<const program_image> &image, const run_options &options, coverage_sink &sink,
+                     std::size_t index, const test_case &test, const std::string &work_dir, fork_server *server,
+                     coverage_cache *cache, std::ostream &out) {
+    const auto &prog = image->get_path();
+    test_result result{};
+
+    std::uint64_t cache_key = 0;
+    if (cache) {
+        cache_key = coverage_cache::key(test, cache_salt(options));
+        cached_result cached;
+        if (cache->find(cache_key, cached)) {
+            std::vector<std::uint32_t> counts(image->line_count());
+            for (std::uint32_t i = 0; i < cached.n_lines; ++i) {
+                auto id = cached.lines[2 * i];
+                if (id < counts.size()) counts[id] = cached.lines[2 * i + 1];
+            }
+            result.passed = cached.passed;
+            sink.test_finished(out, *image, test_report{index, test.expected.str(), cached.answer.str(), cached.passed}, counts);
+            result.covered = line_set::from_counts(counts);
+            return result;
+        }
+    }
 
-    set_breakpoint_at_function("main");
-    continue_execution();
+    //built before forking: the child of a threaded parent shouldn't allocate. the arguments
+    //are views into the manifest, so only this test's get terminated copies
+    std::vector<std::string> args{};
+    for (const auto &arg : test.args) {
+        args.push_back(arg.str());
+    }
+    //relative to where we were started, not to the scratch directory; anything which doesn't exist
+    //yet is left alone, and ends up in the scratch directory
+    if (!work_dir.empty()) {
+        char resolved[PATH_MAX];
+        for (std::size_t i = 1; i < args.size(); ++i) {
+            if (!args[i].empty() && args[i][0] != '/' && realpath(args[i].c_str(), resolved) != nullptr) {
+                args[i] = resolved;
+            }
+        }
+    }
+    std::vector<char *> argv{};
+    for (auto &arg : args) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
+    auto input_fd = -1;
+    if (test.has_stdin) {
+        input_fd = make_input_file(test.stdin_payload);
+        if (input_fd < 0) {
+            out << "Error creating stdin\n";
+            return result;
+        }
+    }
 
-    while (true) {
-        try {
-            step_in_advice();
-        } catch (std::out_of_range) {
-            continue_execution();
+    //a memfd rather than a pipe: the debuggee can't block on a full buffer while it's stopped for us
+    auto output_fd = -1;
+    if (options.capture_stdout) {
+        output_fd = memfd_create("minidbg-stdout", MFD_CLOEXEC);
+        if (output_fd < 0) {
+            out << "Error in memfd_create\n";
+            if (input_fd >= 0) close(input_fd);
+            return result;
+        }
+    }
+
+    auto pid = server ? server->spawn(args, input_fd, output_fd) : fork();
+    if (pid == 0) {
+        if (!work_dir.empty() && chdir(work_dir.c_str()) < 0) {
+            std::cerr << "Error in chdir\n";
+            _exit(1);
+        }
+        if ((output_fd >= 0 && dup2(output_fd, STDOUT_FILENO) < 0) ||
+            (input_fd >= 0 && dup2(input_fd, STDIN_FILENO) < 0)) {
+            std::cerr << "Error in dup2\n";
+            _exit(1);
+        }
+        if (ptrace(PTRACE_TRACEME, 0, 0, 0) < 0) {
+            std::cerr << "Error in ptrace\n";
+            _exit(1);
+        }
+        execv(prog.c_str(), argv.data());
+        _exit(1);
+    } else if (pid < 0) {
+        out << "Error in fork\n";
+        if (output_fd >= 0) close(output_fd);
+        if (input_fd >= 0) close(input_fd);
+        return result;
+    }
+    if (input_fd >= 0) close(input_fd);
+
+    //the debugger's notes on signals and watchpoints only belong in a text transcript
+    std::ostringstream notes;
+    debugger dbg{image, pid, sink.transcript() ? out : notes};
+    dbg.set_sink(sink);
+    if (server) dbg.set_started_at_main();
+    dbg.set_trace_variables(options.trace_variables);
+    switch (options.mode) {
+        case coverage_mode::step:
+            dbg.runAdvice();
+            break;
+        case coverage_mode::step_user:
+            dbg.runAdvice(true);
+            break;
+        case coverage_mode::block:
+            dbg.run_block_coverage();
+            break;
+        case coverage_mode::line:
+            dbg.run_line_coverage(false);
+            break;
+        case coverage_mode::first_hit:
+            dbg.run_line_coverage(true);
+            break;
+        case coverage_mode::profile: {
+            //samples count into line_counts, so the sinks report them as hits
+            profile_aggregator aggregator{*image, dbg.line_counts};
+            aggregator.start();
+            dbg.run_profile(options.sample_rate, aggregator.get_ring());
+            aggregator.finish();
+            result.stacks = std::move(aggregator.get_stacks());
             break;
         }
     }
-    std::cout << "\n";
-    std::cout << "Conclusion:   \n";
 
-    std::map<int, int>::iterator iter;
-    iter = source_map.begin();
-    while (iter != source_map.end()) {
-        std::cout << "Line " << iter->first << "was executed for" << " : " << iter->second << " TIMES" << "\n";
-        iter++;
+    if (waitpid(pid, NULL, 0) < 0) {
+        //printf("%d\n", error);
+    }
+    if (!notes.str().empty()) {
+        std::cerr << notes.str();
     }
-    last = 0;
-}
 
-std::vector<std::string> split(const char *s, const char *delim) {
-    std::vector<std::string> result;
-    if (s && strlen(s)) {
-        int len = strlen(s);
-        char *src = new char[len + 1];
-        strcpy(src, s);
-        src[len] = '\0';
-        char *tokenptr = strtok(src, delim);
-        while (tokenptr != NULL) {
-            std::string tk = tokenptr;
-            result.emplace_back(tk);
-            tokenptr = strtok(NULL, delim);
+    std::string line;
+    if (output_fd >= 0) {
+        line = read_output(output_fd, test.expected_block);
+        close(output_fd);
+    } else {
+        auto path = work_dir.empty() ? std::string{"1.txt"} : work_dir + "/1.txt";
+        std::ifstream infile;
+        infile.open(path, std::ios::in);
+        if (test.expected_block) {
+            std::stringstream contents;
+            contents << infile.rdbuf();
+            line = contents.str();
+        } else {
+            getline(infile, line);
         }
-        delete[] src;
     }
+
+    auto expected = test.expected.str();
+    result.passed = line == expected;
+    sink.test_finished(out, *image, test_report{index, expected, line, result.passed}, dbg.line_counts);
+    result.covered = line_set::from_counts(dbg.line_counts);
+    if (cache) cache->add(cache_key, result.passed, dbg.line_counts, line);
     return result;
 }
 
+//a fork server for the calling thread's tests, started in work_dir, or nullptr to exec each test
+std::unique_ptr<fork_server> start_fork_server(const std::shared_ptr<const program_image> &image,
+                                               const run_options &options, const std::string &work_dir) {
+    if (!options.fork_server) return nullptr;
 
-int main(int argc, char *argv[]) {
-    if (argc < 3) {
-        std::cerr << "Program name not specified";
-        return -1;
+    std::unique_ptr<fork_server> server{new fork_server{image}};
+    if (!server->start(work_dir)) {
+        std::cerr << "Error starting fork server (" << server->error() << "), running each test from exec\n";
+        return nullptr;
     }
+    return server;
+}
 
-    auto prog = argv[1];
+//traces the already running process pid for options.attach_seconds, then lets it go on untraced.
+//what it ran in that time is reported as one passing test, with no expected answer
+bool trace_attached(pid_t pid, const run_options &options, coverage_sink &sink, std::ostream &out, test_result &result) {
+    auto prog = process_executable(pid);
+    if (prog.empty()) {
+        std::cerr << "Cannot find the program of " << pid << "\n";
+        return false;
+    }
+    auto image = std::make_shared<const program_image>(prog);
+
+    std::ostringstream notes;
+    debugger dbg{image, pid, sink.transcript() ? out : notes};
+    dbg.set_sink(sink);
+    dbg.set_trace_variables(options.trace_variables);
+    //everything that can be done up front is, so the process is stopped for as short a time as possible
+    sink.begin(out, *image);
+    if (!dbg.attach(attach_timeout)) return false;
+
+    //sleeps in short steps so a process which exits early isn't held up by the timer
+    std::atomic<bool> done{false};
+    std::thread timer{[&] {
+        if (options.attach_seconds == 0) return;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{options.attach_seconds};
+        while (!done.load(std::memory_order_relaxed) && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{10});
+        }
+        if (!done.load(std::memory_order_relaxed)) dbg.request_detach();
+    }};
 
-    char *filePath = argv[2];
-    std::ifstream file;
-    file.open(filePath, std::ios::in);
-    int count = 1;
-    if (!file.is_open())return 0;
-    std::string strLine;
-    while (getline(file, strLine)) {
-        const std::vector<std::string> &vec = split(strLine.c_str(), " ");
-        auto pid = fork();
-        if (pid == 0) {
-            if (ptrace(PTRACE_TRACEME, 0, 0, 0) < 0) {
-                std::cerr << "Error in ptrace\n";
-                return 0;
-            }
-            execl(prog, vec[0].c_str(), vec[1].c_str(),
-                  vec[2].c_str(), vec[3].c_str(), vec[4].c_str(),
-                  vec[5].c_str(), vec[6].c_str(), vec[7].c_str(),
-                  vec[8].c_str(), nullptr);
-        } else if (pid >= 1) {
-            //parent
-            debugger dbg{prog, pid};
+    switch (options.mode) {
+        case coverage_mode::step:
             dbg.runAdvice();
+            break;
+        case coverage_mode::step_user:
+            dbg.runAdvice(true);
+            break;
+        case coverage_mode::block:
+            dbg.run_block_coverage();
+            break;
+        case coverage_mode::line:
+            dbg.run_line_coverage(false);
+            break;
+        case coverage_mode::first_hit:
+            dbg.run_line_coverage(true);
+            break;
+        case coverage_mode::profile: {
+            profile_aggregator aggregator{*image, dbg.line_counts};
+            aggregator.start();
+            dbg.run_profile(options.sample_rate, aggregator.get_ring());
+            aggregator.finish();
+            result.stacks = std::move(aggregator.get_stacks());
+            break;
+        }
+    }
+    done = true;
+    timer.join();
+    dbg.detach(attach_timeout);
 
-            std::cout << "\n";
-            std::cout << "result----- \n";
+    if (!notes.str().empty()) {
+        std::cerr << notes.str();
+    }
+    const auto &stats = get_tracer_stats();
+    std::cerr << "Attached to " << pid << ": threads stopped in " << stats.attach_stop_us << "us, paused for "
+              << stats.attach_pause_us << "us\n";
+
+    result.passed = true;
+    sink.test_finished(out, *image, test_report{0, "", "", true}, dbg.line_counts);
+    result.covered = line_set::from_counts(dbg.line_counts);
+    return true;
+}
 
-            if (pid == 0) {
-                execl(prog, vec[0].c_str(), vec[1].c_str(),
-                      vec[2].c_str(), vec[3].c_str(), vec[4].c_str(),
-                      vec[5].c_str(), vec[6].c_str(), vec[7].c_str(),
-                      vec[8].c_str(), nullptr);
-                std::cout << "\n";
+//folded stacks, one "outer;...;inner count" line each, as flame graph tools take them
+void write_folded_stacks(const char *path, const std::vector<test_result> &results) {
+    std::map<std::string, std::uint64_t> stacks;
+    for (const auto &result : results) {
+        for (const auto &stack : result.stacks) {
+            stacks[stack.first] += stack.second;
+        }
+    }
+    std::ofstream folded{path};
+    for (const auto &stack : stacks) {
+        folded << stack.first << " " << stack.second << "\n";
+    }
+}
+
+//each worker forks and traces its own debuggees, since a tracee belongs to the thread that
+//forked it. workers get a scratch directory each so their 1.txt answers don't collide, unless
+//answers come from stdout, and take their tests straight from the manifest, which hands them
+//out in order. false, with nothing run, if the scratch directories can't be made
+bool run_tests_parallel(const std::shared_ptr<const program_image> &image, const run_options &options, coverage_sink &sink, test_manifest &manifest,
+                        coverage_cache *cache, std::vector<test_result> &results, unsigned jobs, std::ostream &out) {
+    std::mutex output_mutex;
+
+    std::vector<std::string> work_dirs(jobs);
+    if (!options.capture_stdout) {
+        for (auto &work_dir : work_dirs) {
+            char dir_template[] = "/tmp/minidbg.XXXXXX";
+            if (mkdtemp(dir_template) == nullptr) {
+                std::cerr << "Error creating a work directory: " << strerror(errno) << "\n";
+                for (const auto &made : work_dirs) {
+                    if (!made.empty()) rmdir(made.c_str());
+                }
+                return false;
             }
-            else if (pid >= 1) {
-                if (waitpid(pid, NULL, 0) < 0) {
-                    //printf("%d\n", error);
+            work_dir = dir_template;
+        }
+    }
+
+    auto worker = [&](const std::string &work_dir) {
+        auto server = start_fork_server(image, options, work_dir);
+
+        test_case test;
+        std::size_t i;
+        while (manifest.next(test, i)) {
+            std::ostringstream log;
+            auto result = run_test(image, options, sink, i, test, work_dir, server.get(), cache, log);
+
+            std::lock_guard<std::mutex> lock{output_mutex};
+            out << log.str();
+            if (results.size() <= i) results.resize(i + 1);
+            results[i] = std::move(result);
+        }
+
+        server.reset();
+        if (!work_dir.empty()) {
+            unlink((work_dir + "/1.txt").c_str());
+            rmdir(work_dir.c_str());
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < jobs; ++i) {
+        workers.emplace_back(worker, std::cref(work_dirs[i]));
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    run_options options{};
+    unsigned jobs = 1;
+    bool echo_source = true;
+    bool hot_path_report = false;
+    const char *stats_path = nullptr;
+    std::string format = "json";
+    const char *output_path = nullptr;
+    const char *stacks_path = nullptr;
+    auto formula = suspiciousness::ochiai;
+    pid_t attach_pid = 0;
+    const char *cache_dir = nullptr;
+    bool interactive = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:j:qs:Sf:o:r:pFVH:g:a:d:c:i")) != -1) {
+        switch (opt) {
+            case 'm':
+                if (is_prefix(optarg, "step")) {
+                    options.mode = coverage_mode::step;
+                } else if (is_prefix(optarg, "user")) {
+                    options.mode = coverage_mode::step_user;
+                } else if (is_prefix(optarg, "block")) {
+                    options.mode = coverage_mode::block;
+                } else if (is_prefix(optarg, "line")) {
+                    options.mode = coverage_mode::line;
+                } else if (is_prefix(optarg, "first")) {
+                    options.mode = coverage_mode::first_hit;
+                } else if (is_prefix(optarg, "profile")) {
+                    options.mode = coverage_mode::profile;
+                } else {
+                    std::cerr << "Unknown coverage mode " << optarg << "\n";
+                    return -1;
                 }
-                getline(file, strLine);//5.txt
-                std::cout << "correct answer:" << strLine << std::endl;
-                char *path = "1.txt";
-                std::ifstream infile;
-                infile.open(path, std::ios::in);
-                std::string line;
-                getline(infile, line);
-                std::cout << "test answer: " << line << "\n";
-                if(line==strLine){
-                    std::cout<<"success-----\n";
-                    std::map<int, int>::iterator iter;
-                    iter = dbg.source_map.begin();
-                    while (iter != dbg.source_map.end()) {
-                        success_set.insert(iter->first);
-                        iter++;
-                    }
-                    dbg.source_map.clear();
-                } else if(line!=strLine){
-                    std::cout<<"fail-----\n";
-                    std::map<int, int>::iterator iter;
-                    iter = dbg.source_map.begin();
-                    while (iter != dbg.source_map.end()) {
-                        fail_set.insert(iter->first);
-                        iter++;
-                    }
-                    dbg.source_map.clear();
+                break;
+            case 'j':
+                jobs = std::max(1, std::atoi(optarg));
+                break;
+            case 'S':
+                hot_path_report = true;
+                break;
+            case 'q':
+                echo_source = false;
+                break;
+            case 's':
+                stats_path = optarg;
+                break;
+            case 'f':
+                format = optarg;
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'p':
+                options.capture_stdout = true;
+                break;
+            case 'F':
+                options.fork_server = true;
+                break;
+            case 'V':
+                options.trace_variables = true;
+                break;
+            case 'H':
+                options.sample_rate = std::max(1, std::atoi(optarg));
+                break;
+            case 'g':
+                stacks_path = optarg;
+                break;
+            case 'a':
+                attach_pid = std::atoi(optarg);
+                break;
+            case 'd':
+                options.attach_seconds = std::atoi(optarg);
+                break;
+            case 'c':
+                cache_dir = optarg;
+                break;
+            case 'i':
+                interactive = true;
+                break;
+            case 'r':
+                if (!parse_suspiciousness(optarg, formula)) {
+                    std::cerr << "Unknown ranking " << optarg << "\n";
+                    return -1;
                 }
+                break;
+            default:
+                std::cerr << "Usage: minidbg [-m step|user|block|line|first|profile] [-j jobs] [-q] [-s stats.json] [-S]"
+                             " [-f json|text|lcov|binary] [-o coverage] [-r ochiai|tarantula|dstar] [-p] [-F] [-V] [-H hz] [-g stacks]"
+                             " [-c cache_dir] program tests\n"
+                             "       minidbg -a pid [-d seconds] [-m mode] [-f format] [-o coverage] [-H hz] [-g stacks] [-s stats.json] [-S]\n"
+                             "       minidbg -i program\n";
+                return -1;
+        }
+    }
 
+    //there's one process and no tests: nothing to fork, clone, split up, cache or take an answer from
+    if (attach_pid > 0 && (options.fork_server || jobs > 1 || cache_dir || options.capture_stdout)) {
+        std::cerr << "-F, -j, -c and -p don't apply when attaching with -a\n";
+        return -1;
+    }
 
-            }
+    //the command prompt, on one run of the program with no arguments
+    if (interactive) {
+        if (attach_pid > 0 || argc - optind < 1) {
+            std::cerr << "-i takes a program and nothing else\n";
+            return -1;
+        }
+        auto image = std::make_shared<const program_image>(argv[optind]);
+        auto pid = fork();
+        if (pid == 0) {
+            execute_debugee(argv[optind]);
+            _exit(1);
+        } else if (pid < 0) {
+            std::cerr << "Error in fork\n";
+            return -1;
         }
+        debugger dbg{image, pid, std::cout};
+        dbg.run();
+        return 0;
     }
 
- std::cout<<"ANALYZE :  \n";
-    std::set<int>::iterator it;
-    for(it=fail_set.begin ();it!=fail_set.end ();it++)
-    {
-        if(success_set.find(*it)==success_set.end()){
-            std::cout<<"Line :"<<*it<<" is likely to be a fault\n";
+    if (attach_pid <= 0 && argc - optind < 2) {
+        std::cerr << "Program name not specified";
+        return -1;
+    }
+
+    auto sink = make_coverage_sink(format, echo_source);
+    if (!sink) {
+        std::cerr << "Unknown output format " << format << "\n";
+        return -1;
+    }
+
+    std::ofstream output_file;
+    if (output_path) {
+        output_file.open(output_path, std::ios::out | std::ios::binary);
+        if (!output_file.is_open()) {
+            std::cerr << "Error opening " << output_path << "\n";
+            return -1;
+        }
+    }
+    std::ostream &out = output_path ? output_file : std::cout;
+
+    if (attach_pid > 0) {
+        std::vector<test_result> results(1);
+        if (!trace_attached(attach_pid, options, *sink, out, results[0])) return -1;
+        out.flush();
+        if (stacks_path) {
+            write_folded_stacks(stacks_path, results);
+        }
+        if (stats_path) {
+            std::ofstream stats{stats_path};
+            get_tracer_stats().write_json(stats);
+        }
+        if (hot_path_report) get_hot_path_stats().write_report(std::cerr);
+        return 0;
+    }
+
+    std::string prog = argv[optind];
+
+    char *filePath = argv[optind + 1];
+    test_manifest manifest{filePath};
+    if (!manifest.valid())return 0;
+
+    //the workers change directory before exec, so the program path must survive that
+    if (jobs > 1) {
+        char resolved[PATH_MAX];
+        if (realpath(prog.c_str(), resolved) != nullptr) {
+            prog = resolved;
+        }
+    }
+    auto image = std::make_shared<const program_image>(prog);
+
+    //profiles are samples rather than coverage, and nothing to reuse
+    std::unique_ptr<coverage_cache> cache;
+    if (cache_dir && options.mode != coverage_mode::profile) {
+        cache.reset(new coverage_cache{cache_dir, *image});
+        if (!cache->valid()) {
+            std::cerr << "Error opening the coverage cache in " << cache_dir << "\n";
+            cache.reset();
         }
     }
 
+    std::vector<test_result> results;
+    sink->begin(out, *image);
+    if (jobs == 1) {
+        auto server = start_fork_server(image, options, "");
+        test_case test;
+        std::size_t i;
+        while (manifest.next(test, i)) {
+            results.push_back(run_test(image, options, *sink, i, test, "", server.get(), cache.get(), out));
+        }
+    } else if (!run_tests_parallel(image, options, *sink, manifest, cache.get(), results, jobs, out)) {
+        return -1;
+    }
+    out.flush();
+    if (cache) {
+        std::cerr << "Coverage cache: " << cache->hits() << " tests reused, " << cache->misses() << " traced\n";
+    }
+
+    coverage_matrix matrix{image->line_count(), results.size()};
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        matrix.add_test(i, results[i].passed, results[i].covered);
+    }
+
+ std::cout<<"ANALYZE :  \n";
+    auto ranking = matrix.rank(formula, std::max(1u, std::thread::hardware_concurrency()));
+    for (std::size_t i = 0; i < ranking.size(); ++i) {
+        const auto &location = image->get_location(ranking[i].id);
+        std::cout << i + 1 << ". " << location.file << ":" << location.line << " suspiciousness " << ranking[i].score
+                  << " (failed " << ranking[i].failed << ", passed " << ranking[i].passed << ")\n";
+    }
+
+    if (stacks_path) {
+        write_folded_stacks(stacks_path, results);
+    }
+
+    if (stats_path) {
+        std::ofstream stats{stats_path};
+        get_tracer_stats().write_json(stats);
+    }
+    //after every test rather than each runAdvice: the counters are process wide
+    if (hot_path_report) get_hot_path_stats().write_report(std::cerr);
+
 
 }
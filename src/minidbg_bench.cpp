@@ -0,0 +1,185 @@
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//runs each program natively and under every minidbg engine, and prints one JSON object per
+//(program, engine) pair on stdout
+
+struct run_result {
+    double wall_ms;
+    long max_rss_kb;
+    bool ok;
+};
+
+struct trace_counts {
+    unsigned long long ptrace_calls = 0;
+    unsigned long long memory_calls = 0;
+    unsigned long long waits = 0;
+    unsigned long long stops = 0;
+};
+
+static const std::vector<std::string> engines{"step", "user", "block", "line", "first", "profile"};
+
+run_result spawn(const std::vector<std::string> &args) {
+    std::vector<char *> argv{};
+    for (const auto &arg : args) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    auto start = std::chrono::steady_clock::now();
+    auto pid = fork();
+    if (pid == 0) {
+        //keep the debugger's transcript out of the measurement
+        auto null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        execv(argv[0], argv.data());
+        _exit(127);
+    } else if (pid < 0) {
+        return run_result{0, 0, false};
+    }
+
+    int status;
+    rusage usage{};
+    wait4(pid, &status, 0, &usage);
+    auto end = std::chrono::steady_clock::now();
+
+    auto wall_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    return run_result{wall_ms, usage.ru_maxrss, WIFEXITED(status) && WEXITSTATUS(status) != 127};
+}
+
+unsigned long long read_counter(const std::string &json, const std::string &name) {
+    auto key = "\"" + name + "\":";
+    auto pos = json.find(key);
+    if (pos == std::string::npos) return 0;
+    return std::stoull(json.substr(pos + key.size()));
+}
+
+trace_counts read_counts(const std::string &path) {
+    std::ifstream file{path};
+    std::stringstream ss;
+    ss << file.rdbuf();
+    auto json = ss.str();
+
+    trace_counts counts{};
+    counts.ptrace_calls = read_counter(json, "ptrace_calls");
+    counts.memory_calls = read_counter(json, "memory_calls");
+    counts.waits = read_counter(json, "waits");
+    counts.stops = read_counter(json, "stops");
+    return counts;
+}
+
+std::string quote(const std::string &s) {
+    std::string out{"\""};
+    for (auto c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+std::string make_temp_file(const std::string &contents) {
+    char path[] = "/tmp/minidbg_bench.XXXXXX";
+    auto fd = mkstemp(path);
+    if (fd < 0) return {};
+    if (write(fd, contents.data(), contents.size()) < 0) {
+        std::cerr << "Error writing " << path << "\n";
+    }
+    close(fd);
+    return path;
+}
+
+void report(const std::string &program, const std::string &engine, const std::vector<run_result> &runs,
+            const trace_counts &counts, double native_ms) {
+    double total_ms = 0;
+    double min_ms = runs.empty() ? 0 : runs[0].wall_ms;
+    long max_rss_kb = 0;
+    bool ok = true;
+    for (const auto &r : runs) {
+        total_ms += r.wall_ms;
+        min_ms = std::min(min_ms, r.wall_ms);
+        max_rss_kb = std::max(max_rss_kb, r.max_rss_kb);
+        ok = ok && r.ok;
+    }
+    auto mean_ms = runs.empty() ? 0 : total_ms / runs.size();
+    auto steps_per_sec = mean_ms > 0 ? counts.stops / (mean_ms / 1000) : 0;
+
+    std::cout << "{\"program\":" << quote(program)
+              << ",\"engine\":" << quote(engine)
+              << ",\"runs\":" << runs.size()
+              << ",\"ok\":" << (ok ? "true" : "false")
+              << ",\"wall_ms_min\":" << min_ms
+              << ",\"wall_ms_mean\":" << mean_ms
+              << ",\"slowdown\":" << (native_ms > 0 ? mean_ms / native_ms : 0)
+              << ",\"max_rss_kb\":" << max_rss_kb
+              << ",\"ptrace_calls\":" << counts.ptrace_calls
+              << ",\"memory_calls\":" << counts.memory_calls
+              << ",\"waits\":" << counts.waits
+              << ",\"stops\":" << counts.stops
+              << ",\"steps_per_sec\":" << steps_per_sec
+              << "}" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned runs = 5;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:")) != -1) {
+        switch (opt) {
+            case 'r':
+                runs = std::max(1, std::atoi(optarg));
+                break;
+            default:
+                std::cerr << "Usage: minidbg_bench [-r runs] minidbg program...\n";
+                return -1;
+        }
+    }
+
+    if (argc - optind < 2) {
+        std::cerr << "Usage: minidbg_bench [-r runs] minidbg program...\n";
+        return -1;
+    }
+
+    std::string minidbg = argv[optind];
+    for (auto i = optind + 1; i < argc; ++i) {
+        std::string program = argv[i];
+
+        std::vector<run_result> native{};
+        for (unsigned r = 0; r < runs; ++r) {
+            native.push_back(spawn({program}));
+        }
+        double native_ms = 0;
+        for (const auto &n : native) native_ms += n.wall_ms;
+        native_ms /= native.size();
+        report(program, "native", native, trace_counts{}, native_ms);
+
+        //one test case: the program with no arguments and no expected answer
+        auto tests_path = make_temp_file(program + "\n\n");
+        auto stats_path = make_temp_file("");
+        if (tests_path.empty() || stats_path.empty()) {
+            std::cerr << "Error creating temporary files\n";
+            return -1;
+        }
+
+        for (const auto &engine : engines) {
+            std::vector<run_result> traced{};
+            for (unsigned r = 0; r < runs; ++r) {
+                traced.push_back(spawn({minidbg, "-q", "-m", engine, "-s", stats_path, program, tests_path}));
+            }
+            report(program, engine, traced, read_counts(stats_path), native_ms);
+        }
+
+        unlink(tests_path.c_str());
+        unlink(stats_path.c_str());
+    }
+}